@@ -0,0 +1,94 @@
+// Compares datagram checksums, ENet's byte table CRC32 against slice-by-8 and hardware CRC32C.
+// Usage: net_bench_checksum [iterations]
+// Checksums the same random buffer over and over for each datagram size and verifies that the software and
+// hardware CRC32C agree on random sizes and alignments.
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/os.h"
+#include "crc32c.h"
+#include "enet/enet.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Lumix;
+
+namespace {
+
+struct Random {
+	u32 next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	u32 state = 0x12345678;
+};
+
+using ChecksumFn = u32 (*)(const u8* data, u32 size);
+
+u32 checksumENet(const u8* data, u32 size) {
+	ENetBuffer buffer;
+	buffer.data = (void*)data;
+	buffer.dataLength = size;
+	return enet_crc32(&buffer, 1);
+}
+
+u32 checksumSoftware(const u8* data, u32 size) { return crc32cSoftware(data, size); }
+u32 checksumCRC32C(const u8* data, u32 size) { return crc32c(data, size); }
+
+void measure(const char* name, ChecksumFn fn, const u8* data, u32 size, u32 iterations) {
+	// the sum keeps the compiler from dropping the calls
+	u32 sum = 0;
+	os::Timer timer;
+	for (u32 i = 0; i < iterations; ++i) sum += fn(data + (i & 7), size);
+	const double time = timer.getTimeSinceStart();
+	const double bytes = double(size) * iterations;
+	printf("checksum impl=%s size=%u mbps=%.1f ns_per_datagram=%.1f sum=%08x\n"
+		, name
+		, size
+		, time > 0 ? bytes / (1024.0 * 1024.0) / time : 0.0
+		, time * 1e9 / iterations
+		, sum);
+}
+
+u32 verify(const u8* data, u32 size, u32 count) {
+	Random rng;
+	u32 failures = 0;
+	for (u32 i = 0; i < count; ++i) {
+		const u32 offset = rng.next() % 64;
+		const u32 len = rng.next() % (size - offset);
+		const u32 split = len ? rng.next() % len : 0;
+		const u32 whole = crc32c(data + offset, len);
+		if (whole != crc32cSoftware(data + offset, len)) ++failures;
+		// chained checksums of parts equal the checksum of the whole
+		if (whole != crc32c(data + offset + split, len - split, crc32c(data + offset, split))) ++failures;
+	}
+	return failures;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	const u32 iterations = argc > 1 ? (u32)atoi(argv[1]) : 1000000;
+	constexpr u32 BUFFER_SIZE = 4096 + 64;
+
+	DefaultAllocator allocator;
+	Array<u8> buffer(allocator);
+	buffer.resize(BUFFER_SIZE);
+	Random rng;
+	for (u8& b : buffer) b = u8(rng.next());
+
+	// "123456789" is the standard check value input
+	const u32 check = crc32c("123456789", 9);
+	const u32 failures = verify(buffer.begin(), BUFFER_SIZE, 100000);
+	printf("checksum accelerated=%d check=%08x expected=e3069283 failures=%u\n", isCRC32CAccelerated() ? 1 : 0, check, failures);
+
+	const u32 sizes[] = {64, 256, 1200, 4096};
+	for (u32 size : sizes) {
+		measure("enet_crc32", &checksumENet, buffer.begin(), size, iterations);
+		measure("crc32c_slice8", &checksumSoftware, buffer.begin(), size, iterations);
+		measure("crc32c", &checksumCRC32C, buffer.begin(), size, iterations);
+	}
+	return failures == 0 && check == 0xe3069283 ? 0 : 2;
+}
@@ -0,0 +1,268 @@
+// Compares compression of datagrams by ENet's range coder and LZCompressor, with and without a dictionary.
+// Usage: net_bench_compression [capture files]
+// A capture file is a sequence of datagrams, each a little endian u32 size followed by the datagram. Without
+// captures, traffic is synthesized from replication deltas and small RPC-like messages with ENet headers.
+// The dictionary is trained on the first part of the traffic and everything is measured on the rest.
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/math.h"
+#include "core/os.h"
+#include "core/stream.h"
+#include "enet/enet.h"
+#include "lz_compressor.h"
+#include "replication.h"
+#include "varint.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Lumix;
+
+namespace {
+
+struct Random {
+	u32 next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	float nextFloat() { return (next() & 0xffFFff) / float(0x1000000); }
+	u32 state = 0x12345678;
+};
+
+struct Datagram {
+	u32 offset;
+	u32 size;
+};
+
+struct Traffic {
+	Traffic(IAllocator& allocator)
+		: data(allocator)
+		, datagrams(allocator)
+	{}
+
+	void push(const void* ptr, u32 size) {
+		if (size == 0 || size > LZCompressor::MAX_INPUT_SIZE) return;
+		datagrams.push({(u32)data.size(), size});
+		data.write(ptr, size);
+	}
+	Span<const u8> get(u32 idx) const { return Span<const u8>(data.data() + datagrams[idx].offset, datagrams[idx].size); }
+
+	OutputMemoryStream data;
+	Array<Datagram> datagrams;
+};
+
+bool loadCapture(const char* path, Traffic& traffic) {
+	FILE* file = fopen(path, "rb");
+	if (!file) return false;
+	u8 buf[LZCompressor::MAX_INPUT_SIZE];
+	u8 size_bytes[4];
+	while (fread(size_bytes, sizeof(size_bytes), 1, file) == 1) {
+		const u32 size = size_bytes[0] | (size_bytes[1] << 8) | (size_bytes[2] << 16) | (size_bytes[3] << 24);
+		if (size > sizeof(buf) || fread(buf, size, 1, file) != 1) break;
+		traffic.push(buf, size);
+	}
+	fclose(file);
+	return true;
+}
+
+struct Transform {
+	float pos[3];
+	float rot[4];
+};
+
+struct SyntheticWorld {
+	SyntheticWorld(IAllocator& allocator) : transforms(allocator) {}
+
+	void readTransform(EntityRef e, Span<u8> out) { memcpy(out.begin(), &transforms[e.index], sizeof(Transform)); }
+	void writeTransform(EntityRef e, Span<const u8> in) {}
+
+	Array<Transform> transforms;
+};
+
+// protocol header (peer id, sent time) and a send command header, roughly what ENet puts in front of the data
+void writeENetHeaders(OutputMemoryStream& out, u32 tick, u8 channel, u16 sequence, u32 size, bool reliable) {
+	out.write(u16(0x8000 | 3));
+	out.write(u16(tick * 16));
+	out.write(u8(reliable ? 0x86 : 0x07));
+	out.write(channel);
+	out.write(sequence);
+	if (!reliable) out.write(u16(sequence));
+	out.write(u16(size));
+}
+
+void synthesize(IAllocator& allocator, Traffic& traffic) {
+	constexpr u32 ENTITIES = 300;
+	constexpr u32 TICKS = 2000;
+	constexpr u32 MTU = 1200;
+
+	Random rng;
+	SyntheticWorld world(allocator);
+	world.transforms.resize(ENTITIES);
+	Replication replication(allocator);
+	Replication::ReadFn read;
+	Replication::WriteFn write;
+	read.bind<&SyntheticWorld::readTransform>(&world);
+	write.bind<&SyntheticWorld::writeTransform>(&world);
+	replication.registerField("transform", sizeof(Transform), read, write);
+	for (u32 i = 0; i < ENTITIES; ++i) {
+		Transform& tr = world.transforms[i];
+		tr.pos[0] = rng.nextFloat() * 1000;
+		tr.pos[1] = 0;
+		tr.pos[2] = rng.nextFloat() * 1000;
+		tr.rot[0] = tr.rot[2] = 0;
+		tr.rot[1] = rng.nextFloat();
+		tr.rot[3] = 1;
+		replication.addEntity(EntityRef{(i32)i}, 1);
+	}
+
+	OutputMemoryStream delta(allocator);
+	OutputMemoryStream datagram(allocator);
+	OutputMemoryStream message(allocator);
+	u32 acked = 0;
+	for (u32 tick = 1; tick <= TICKS; ++tick) {
+		for (Transform& tr : world.transforms) {
+			if (rng.nextFloat() > 0.2f) continue;
+			tr.pos[0] += rng.nextFloat() - 0.5f;
+			tr.pos[2] += rng.nextFloat() - 0.5f;
+			tr.rot[1] = rng.nextFloat();
+		}
+		const u32 snapshot = replication.captureSnapshot();
+		delta.clear();
+		replication.writeDelta(acked, delta);
+		if (tick % 3 == 0) acked = snapshot - 3;
+
+		for (u32 offset = 0; offset < delta.size(); offset += MTU) {
+			const u32 size = minimum(MTU, u32(delta.size() - offset));
+			datagram.clear();
+			writeENetHeaders(datagram, tick, 3, u16(tick), size, false);
+			datagram.write(delta.data() + offset, size);
+			traffic.push(datagram.data(), (u32)datagram.size());
+		}
+
+		// a few RPCs: function id, entity and a couple of arguments
+		datagram.clear();
+		const u32 rpcs = rng.next() % 4;
+		for (u32 i = 0; i < rpcs; ++i) {
+			message.clear();
+			writeVarint(message, rng.next() % 8);
+			writeVarint(message, rng.next() % ENTITIES);
+			message.write(u8(rng.next() % 3));
+			message.write(float(i32(rng.next() % 100)));
+			if (rng.next() % 2) message.write("use_item", 8);
+			writeENetHeaders(datagram, tick, 1, u16(tick * 4 + i), (u32)message.size(), true);
+			datagram.write(message.data(), message.size());
+		}
+		if (!datagram.empty()) traffic.push(datagram.data(), (u32)datagram.size());
+	}
+}
+
+struct Result {
+	u64 in_bytes = 0;
+	u64 out_bytes = 0;
+	double compress_time = 0;
+	double decompress_time = 0;
+	u32 failures = 0;
+};
+
+// returns 0 if the datagram is sent uncompressed
+using CompressFn = u32 (*)(void* ctx, Span<const u8> in, u8* out);
+using DecompressFn = u32 (*)(void* ctx, const u8* in, u32 size, u8* out);
+
+Result measure(const Traffic& traffic, u32 from, void* ctx, CompressFn compress, DecompressFn decompress) {
+	Result res;
+	u8 compressed[LZCompressor::MAX_INPUT_SIZE];
+	u8 decompressed[LZCompressor::MAX_INPUT_SIZE];
+	for (u32 i = from; i < (u32)traffic.datagrams.size(); ++i) {
+		const Span<const u8> datagram = traffic.get(i);
+		res.in_bytes += datagram.length();
+		os::Timer timer;
+		const u32 size = compress(ctx, datagram, compressed);
+		res.compress_time += timer.getTimeSinceStart();
+		if (size == 0) {
+			res.out_bytes += datagram.length();
+			continue;
+		}
+		res.out_bytes += size;
+
+		timer.tick();
+		const u32 decompressed_size = decompress(ctx, compressed, size, decompressed);
+		res.decompress_time += timer.getTimeSinceStart();
+		if (decompressed_size != datagram.length() || memcmp(decompressed, datagram.begin(), decompressed_size) != 0) ++res.failures;
+	}
+	return res;
+}
+
+u32 compressNone(void*, Span<const u8>, u8*) { return 0; }
+u32 decompressNone(void*, const u8*, u32, u8*) { return 0; }
+
+// same limits as ENet, compressed data must be smaller than the original
+u32 compressRangeCoder(void* ctx, Span<const u8> in, u8* out) {
+	ENetBuffer buffer;
+	buffer.data = (void*)in.begin();
+	buffer.dataLength = in.length();
+	return (u32)enet_range_coder_compress(ctx, &buffer, 1, in.length(), out, in.length());
+}
+
+u32 decompressRangeCoder(void* ctx, const u8* in, u32 size, u8* out) {
+	return (u32)enet_range_coder_decompress(ctx, in, size, out, LZCompressor::MAX_INPUT_SIZE);
+}
+
+u32 compressLZ(void* ctx, Span<const u8> in, u8* out) {
+	return ((LZCompressor*)ctx)->compress(in.begin(), in.length(), out, in.length());
+}
+
+u32 decompressLZ(void* ctx, const u8* in, u32 size, u8* out) {
+	return ((LZCompressor*)ctx)->decompress(in, size, out, LZCompressor::MAX_INPUT_SIZE);
+}
+
+void print(const char* name, const Result& res) {
+	const double mb = res.in_bytes / (1024.0 * 1024.0);
+	printf("compression codec=%s in_bytes=%llu out_bytes=%llu ratio=%.3f compress_mbps=%.1f decompress_mbps=%.1f failures=%u\n"
+		, name
+		, (unsigned long long)res.in_bytes
+		, (unsigned long long)res.out_bytes
+		, res.out_bytes ? double(res.in_bytes) / res.out_bytes : 0.0
+		, res.compress_time > 0 ? mb / res.compress_time : 0.0
+		, res.decompress_time > 0 ? mb / res.decompress_time : 0.0
+		, res.failures);
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	DefaultAllocator allocator;
+	Traffic traffic(allocator);
+	for (int i = 1; i < argc; ++i) {
+		if (!loadCapture(argv[i], traffic)) {
+			fprintf(stderr, "Failed to read %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (argc < 2) synthesize(allocator, traffic);
+	if (traffic.datagrams.size() < 2) {
+		fprintf(stderr, "Not enough datagrams\n");
+		return 1;
+	}
+
+	const u32 training_count = traffic.datagrams.size() / 5;
+	Array<Span<const u8>> samples(allocator);
+	for (u32 i = 0; i < training_count; ++i) samples.push(traffic.get(i));
+	OutputMemoryStream dictionary(allocator);
+	LZCompressor::trainDictionary(allocator, Span<const Span<const u8>>(samples.begin(), samples.size()), 16 * 1024, dictionary);
+	printf("compression datagrams=%u training_datagrams=%u dictionary_bytes=%u\n", traffic.datagrams.size(), training_count, (u32)dictionary.size());
+
+	print("none", measure(traffic, training_count, nullptr, &compressNone, &decompressNone));
+
+	void* range_coder = enet_range_coder_create();
+	print("range_coder", measure(traffic, training_count, range_coder, &compressRangeCoder, &decompressRangeCoder));
+	enet_range_coder_destroy(range_coder);
+
+	LZCompressor lz(allocator, Span<const u8>());
+	print("lz", measure(traffic, training_count, &lz, &compressLZ, &decompressLZ));
+
+	LZCompressor lz_dictionary(allocator, Span<const u8>((const u8*)dictionary.data(), (u32)dictionary.size()));
+	print("lz_dictionary", measure(traffic, training_count, &lz_dictionary, &compressLZ, &decompressLZ));
+	return 0;
+}
@@ -0,0 +1,480 @@
+// Load test of the network transport over localhost. A server host and N client hosts, all serviced
+// on this thread, exchange a mix of messages using the channels and framing of the network plugin.
+// Clients send, the server measures one way latency, all hosts share the same clock.
+// Loss, latency and jitter are injected with ENetHost::intercept on all receiving hosts.
+//
+// Usage: net_bench_loopback [--clients N] [--seconds S] [--rate messages per second per client] [--tick-rate Hz]
+//	[--size USER blob bytes] [--mix reliable,unreliable,rpc,string] [--loss 0-1] [--latency ms] [--jitter ms]
+//	[--batch-io N] [--port P]
+// Prints one line of key=value pairs.
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/math.h"
+#include "core/os.h"
+#include "core/stream.h"
+#include "enet/enet.h"
+#include "rpc.h"
+#include "varint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace Lumix;
+
+namespace {
+
+// same as NetSystemImpl::Channel
+enum class Channel : u8 {
+	RPC = 0,
+	LUA_STRING = 1,
+	USER = 2,
+	REPLICATION = 3,
+	BATCH = 4,
+	STREAM = 5,
+
+	COUNT
+};
+
+enum class MessageKind : u32 {
+	RELIABLE,
+	UNRELIABLE,
+	RPC,
+	STRING,
+
+	COUNT
+};
+
+struct Config {
+	u32 clients = 8;
+	float seconds = 10;
+	u32 rate = 600;
+	u32 tick_rate = 60;
+	u32 size = 64;
+	u32 mix[(u32)MessageKind::COUNT] = {4, 4, 1, 1};
+	float loss = 0;
+	float latency = 0; // seconds
+	float jitter = 0; // seconds
+	u32 batch_io = 32;
+	u16 port = 34567;
+};
+
+struct Random {
+	u32 next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	float nextFloat() { return (next() & 0xffFFff) / float(0x1000000); }
+	u32 state = 0x12345678;
+};
+
+double now() {
+	return os::Timer::getRawTimestamp() / double(os::Timer::getFrequency());
+}
+
+// Received datagrams wait in a queue sorted by release time. Wake up datagrams from the pump socket
+// give the host a chance to process released datagrams even if nothing else arrives: every time the
+// intercept is called, the released datagram, if there is one, takes place of the received one.
+struct Impairment {
+	struct Datagram {
+		double release;
+		ENetAddress address;
+		u32 size;
+		u8 data[ENET_PROTOCOL_MAXIMUM_MTU];
+	};
+
+	Impairment(IAllocator& allocator, ENetHost* host, const Config& config, ENetAddress pump_address, u32 seed)
+		: allocator(allocator)
+		, host(host)
+		, config(config)
+		, pump_address(pump_address)
+		, queue(allocator)
+		, pool(allocator)
+	{
+		rng.state = 0x9e3779b9 ^ seed;
+		enet_socket_get_address(host->socket, &address);
+		address.host = ENET_HOST_TO_NET_32(0x7f000001);
+	}
+
+	~Impairment() {
+		for (Datagram* d : queue) LUMIX_DELETE(allocator, d);
+		for (Datagram* d : pool) LUMIX_DELETE(allocator, d);
+		LUMIX_DELETE(allocator, processing);
+	}
+
+	Datagram* alloc() {
+		if (pool.empty()) return LUMIX_NEW(allocator, Datagram);
+		Datagram* d = pool.last();
+		pool.pop();
+		return d;
+	}
+
+	u32 getReleasedCount(double time) const {
+		u32 count = 0;
+		while (count < (u32)queue.size() && queue[count]->release <= time) ++count;
+		return count;
+	}
+
+	int intercept() {
+		// ENet is done with the previous one
+		if (processing) {
+			pool.push(processing);
+			processing = nullptr;
+		}
+
+		const double time = now();
+		const bool is_wake_up = host->receivedAddress.host == pump_address.host && host->receivedAddress.port == pump_address.port;
+		if (!is_wake_up && rng.nextFloat() >= config.loss) {
+			Datagram* d = alloc();
+			d->release = time + config.latency + config.jitter * rng.nextFloat();
+			d->address = host->receivedAddress;
+			d->size = (u32)host->receivedDataLength;
+			memcpy(d->data, host->receivedData, d->size);
+			u32 idx = queue.size();
+			while (idx > 0 && queue[idx - 1]->release > d->release) --idx;
+			queue.insert(idx, d);
+		}
+
+		if (queue.empty() || queue[0]->release > time) return 1;
+
+		processing = queue[0];
+		queue.erase(0);
+		host->receivedAddress = processing->address;
+		host->receivedData = processing->data;
+		host->receivedDataLength = processing->size;
+		return 0;
+	}
+
+	IAllocator& allocator;
+	ENetHost* host;
+	const Config& config;
+	ENetAddress pump_address;
+	// where wake ups are sent
+	ENetAddress address;
+	Array<Datagram*> queue;
+	Array<Datagram*> pool;
+	Datagram* processing = nullptr;
+	Random rng;
+};
+
+// ENet's intercept has no context
+Array<Impairment*>* g_impairments = nullptr;
+
+int ENET_CALLBACK interceptCallback(ENetHost* host, ENetEvent* event) {
+	for (Impairment* impairment : *g_impairments) {
+		if (impairment->host == host) return impairment->intercept();
+	}
+	return 0;
+}
+
+void pump(ENetSocket socket, const Array<Impairment*>& impairments) {
+	const double time = now();
+	u8 byte = 0;
+	ENetBuffer buffer;
+	buffer.data = &byte;
+	buffer.dataLength = 1;
+	for (Impairment* impairment : impairments) {
+		for (u32 i = 0, c = impairment->getReleasedCount(time); i < c; ++i) enet_socket_send(socket, &impairment->address, &buffer, 1);
+	}
+}
+
+struct Stats {
+	Stats(IAllocator& allocator) : latencies(allocator) {}
+
+	u64 sent[(u32)MessageKind::COUNT] = {};
+	u64 received[(u32)MessageKind::COUNT] = {};
+	u64 received_bytes = 0;
+	Array<u32> latencies; // microseconds
+};
+
+// every message ends with the send time, so the server can tell the latency regardless of the message kind
+void writeMessage(OutputMemoryStream& blob, MessageKind kind, const Config& config, Random& rng) {
+	blob.clear();
+	switch (kind) {
+		case MessageKind::RELIABLE:
+		case MessageKind::UNRELIABLE:
+			for (u32 i = 0; i < config.size; ++i) blob.write(u8(rng.next()));
+			break;
+		case MessageKind::RPC:
+			// call by id with three numeric arguments
+			blob.write(rpc::MessageType::CALL_BY_ID);
+			writeVarint(blob, rng.next() % 16);
+			writeVarint(blob, 3);
+			for (u32 i = 0; i < 3; ++i) {
+				blob.write(u8(5)); // tag of f32
+				blob.write(rng.nextFloat() * 100);
+			}
+			break;
+		case MessageKind::STRING: {
+			char tmp[64];
+			const int len = snprintf(tmp, sizeof(tmp), "player %u moved %.2f %.2f", rng.next() % 100, rng.nextFloat() * 100, rng.nextFloat() * 100);
+			blob.write(tmp, len + 1);
+			break;
+		}
+		case MessageKind::COUNT: ASSERT(false); break;
+	}
+	blob.write(os::Timer::getRawTimestamp());
+}
+
+void send(ENetPeer* peer, MessageKind kind, const OutputMemoryStream& blob) {
+	Channel channel = Channel::USER;
+	bool reliable = true;
+	switch (kind) {
+		case MessageKind::RELIABLE: break;
+		case MessageKind::UNRELIABLE: reliable = false; break;
+		case MessageKind::RPC: channel = Channel::RPC; break;
+		case MessageKind::STRING: channel = Channel::LUA_STRING; break;
+		case MessageKind::COUNT: ASSERT(false); break;
+	}
+	ENetPacket* packet = enet_packet_create(blob.data(), blob.size(), reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+	if (enet_peer_send(peer, (u8)channel, packet) != 0) enet_packet_destroy(packet);
+}
+
+MessageKind getKind(const ENetEvent& event) {
+	switch ((Channel)event.channelID) {
+		case Channel::RPC: return MessageKind::RPC;
+		case Channel::LUA_STRING: return MessageKind::STRING;
+		default: return event.packet->flags & ENET_PACKET_FLAG_RELIABLE ? MessageKind::RELIABLE : MessageKind::UNRELIABLE;
+	}
+}
+
+// returns true if there was any event
+bool serviceServer(ENetHost* server, Stats& stats, u32 timeout_ms) {
+	ENetEvent event;
+	bool any = false;
+	while (enet_host_service(server, &event, timeout_ms) > 0) {
+		any = true;
+		timeout_ms = 0;
+		if (event.type != ENET_EVENT_TYPE_RECEIVE) continue;
+
+		const u64 time = os::Timer::getRawTimestamp();
+		u64 sent_time;
+		if (event.packet->dataLength >= sizeof(sent_time)) {
+			memcpy(&sent_time, event.packet->data + event.packet->dataLength - sizeof(sent_time), sizeof(sent_time));
+			stats.latencies.push(u32((time - sent_time) * 1000000 / os::Timer::getFrequency()));
+			++stats.received[(u32)getKind(event)];
+			stats.received_bytes += event.packet->dataLength;
+		}
+		enet_packet_destroy(event.packet);
+	}
+	return any;
+}
+
+void serviceClients(Span<ENetHost* const> clients) {
+	ENetEvent event;
+	for (ENetHost* client : clients) {
+		while (enet_host_service(client, &event, 0) > 0) {
+			if (event.type == ENET_EVENT_TYPE_RECEIVE) enet_packet_destroy(event.packet);
+		}
+	}
+}
+
+int compareU32(const void* a, const void* b) {
+	const u32 va = *(const u32*)a;
+	const u32 vb = *(const u32*)b;
+	return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+u32 percentile(const Array<u32>& sorted, float p) {
+	if (sorted.empty()) return 0;
+	return sorted[minimum(u32(sorted.size() * p), u32(sorted.size() - 1))];
+}
+
+bool parseArgs(int argc, char** argv, Config& config) {
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!value) return false;
+		++i;
+		if (strcmp(arg, "--clients") == 0) config.clients = atoi(value);
+		else if (strcmp(arg, "--seconds") == 0) config.seconds = (float)atof(value);
+		else if (strcmp(arg, "--rate") == 0) config.rate = atoi(value);
+		else if (strcmp(arg, "--tick-rate") == 0) config.tick_rate = atoi(value);
+		else if (strcmp(arg, "--size") == 0) config.size = atoi(value);
+		else if (strcmp(arg, "--loss") == 0) config.loss = (float)atof(value);
+		else if (strcmp(arg, "--latency") == 0) config.latency = (float)atof(value) / 1000;
+		else if (strcmp(arg, "--jitter") == 0) config.jitter = (float)atof(value) / 1000;
+		else if (strcmp(arg, "--batch-io") == 0) config.batch_io = atoi(value);
+		else if (strcmp(arg, "--port") == 0) config.port = (u16)atoi(value);
+		else if (strcmp(arg, "--mix") == 0) {
+			u32* mix = config.mix;
+			if (sscanf(value, "%u,%u,%u,%u", &mix[0], &mix[1], &mix[2], &mix[3]) != 4) return false;
+		}
+		else return false;
+	}
+	u32 mix_total = 0;
+	for (u32 w : config.mix) mix_total += w;
+	return config.clients > 0 && config.tick_rate > 0 && config.seconds > 0 && mix_total > 0;
+}
+
+MessageKind pickKind(const Config& config, Random& rng) {
+	u32 total = 0;
+	for (u32 w : config.mix) total += w;
+	u32 r = rng.next() % total;
+	for (u32 i = 0; i < (u32)MessageKind::COUNT; ++i) {
+		if (r < config.mix[i]) return (MessageKind)i;
+		r -= config.mix[i];
+	}
+	return MessageKind::RELIABLE;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	Config config;
+	if (!parseArgs(argc, argv, config)) {
+		fprintf(stderr, "Usage: net_bench_loopback [--clients N] [--seconds S] [--rate N] [--tick-rate Hz] [--size bytes] "
+			"[--mix reliable,unreliable,rpc,string] [--loss 0-1] [--latency ms] [--jitter ms] [--batch-io N] [--port P]\n");
+		return 1;
+	}
+	if (enet_initialize() != 0) {
+		fprintf(stderr, "Failed to initialize ENet\n");
+		return 1;
+	}
+
+	DefaultAllocator allocator;
+	ENetAddress server_address;
+	enet_address_set_host_ip(&server_address, "127.0.0.1");
+	server_address.port = config.port;
+	ENetHost* server = enet_host_create(&server_address, config.clients, (size_t)Channel::COUNT, 0, 0);
+	if (!server) {
+		fprintf(stderr, "Failed to create server on port %u\n", config.port);
+		return 1;
+	}
+
+	Array<ENetHost*> clients(allocator);
+	Array<ENetPeer*> peers(allocator);
+	for (u32 i = 0; i < config.clients; ++i) {
+		ENetHost* client = enet_host_create(nullptr, 1, (size_t)Channel::COUNT, 0, 0);
+		if (!client) {
+			fprintf(stderr, "Failed to create client\n");
+			return 1;
+		}
+		clients.push(client);
+		peers.push(enet_host_connect(client, &server_address, (size_t)Channel::COUNT, 0));
+	}
+
+	Array<ENetHost*> hosts(allocator);
+	hosts.push(server);
+	for (ENetHost* client : clients) hosts.push(client);
+	for (ENetHost* host : hosts) {
+		if (config.batch_io > 1) enet_host_batch_io(host, config.batch_io, config.batch_io, 0);
+	}
+
+	// impairment
+	ENetSocket pump_socket = ENET_SOCKET_NULL;
+	Array<Impairment*> impairments(allocator);
+	g_impairments = &impairments;
+	if (config.loss > 0 || config.latency > 0 || config.jitter > 0) {
+		pump_socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+		ENetAddress pump_address;
+		enet_address_set_host_ip(&pump_address, "127.0.0.1");
+		pump_address.port = 0;
+		enet_socket_bind(pump_socket, &pump_address);
+		enet_socket_get_address(pump_socket, &pump_address);
+		for (ENetHost* host : hosts) {
+			impairments.push(LUMIX_NEW(allocator, Impairment)(allocator, host, config, pump_address, impairments.size()));
+			host->intercept = &interceptCallback;
+		}
+	}
+
+	Stats stats(allocator);
+	const Span<ENetHost* const> client_span(clients.begin(), clients.size());
+
+	// connect
+	const double connect_start = now();
+	for (;;) {
+		serviceClients(client_span);
+		serviceServer(server, stats, 1);
+		if (pump_socket != ENET_SOCKET_NULL) pump(pump_socket, impairments);
+		u32 connected = 0;
+		for (ENetPeer* peer : peers) connected += peer->state == ENET_PEER_STATE_CONNECTED ? 1 : 0;
+		if (connected == config.clients) break;
+		if (now() - connect_start > 10) {
+			fprintf(stderr, "Only %u of %u clients connected\n", connected, config.clients);
+			return 1;
+		}
+	}
+
+	Random rng;
+	OutputMemoryStream blob(allocator);
+	const double start = now();
+	const clock_t cpu_start = clock();
+	double next_tick = start;
+	double to_send = 0;
+	const double per_tick = double(config.rate) / config.tick_rate;
+	// keep servicing after the last send, until reliable messages arrive
+	const double drain = 1 + 4 * (config.latency + config.jitter);
+	for (;;) {
+		const double time = now();
+		if (time - start > config.seconds + drain) break;
+
+		if (time >= next_tick && time - start < config.seconds) {
+			next_tick += 1.0 / config.tick_rate;
+			to_send += per_tick;
+			const u32 count = (u32)to_send;
+			to_send -= count;
+			for (u32 c = 0; c < config.clients; ++c) {
+				for (u32 i = 0; i < count; ++i) {
+					const MessageKind kind = pickKind(config, rng);
+					writeMessage(blob, kind, config, rng);
+					send(peers[c], kind, blob);
+					++stats.sent[(u32)kind];
+				}
+			}
+		}
+
+		serviceClients(client_span);
+		if (pump_socket != ENET_SOCKET_NULL) pump(pump_socket, impairments);
+		// waiting in the server's socket keeps the measured latency close to the real one
+		const double until_tick = next_tick - now();
+		serviceServer(server, stats, until_tick > 0.001 ? 1 : 0);
+	}
+	const double cpu_time = double(clock() - cpu_start) / CLOCKS_PER_SEC;
+
+	u64 sent = 0;
+	u64 received = 0;
+	for (u32 i = 0; i < (u32)MessageKind::COUNT; ++i) {
+		sent += stats.sent[i];
+		received += stats.received[i];
+	}
+	const u32 unreliable = (u32)MessageKind::UNRELIABLE;
+	const u64 reliable_sent = sent - stats.sent[unreliable];
+	const u64 reliable_received = received - stats.received[unreliable];
+	if (!stats.latencies.empty()) qsort(stats.latencies.begin(), stats.latencies.size(), sizeof(u32), &compareU32);
+
+	printf("loopback clients=%u seconds=%.1f rate=%u tick_rate=%u size=%u mix=%u,%u,%u,%u loss=%.3f latency_ms=%.1f jitter_ms=%.1f batch_io=%u"
+		" sent=%llu received=%llu reliable_missing=%llu unreliable_lost=%llu messages_per_s=%.0f bytes_per_s=%.0f"
+		" p50_us=%u p99_us=%u max_us=%u cpu_us_per_message=%.3f\n"
+		, config.clients
+		, config.seconds
+		, config.rate
+		, config.tick_rate
+		, config.size
+		, config.mix[0], config.mix[1], config.mix[2], config.mix[3]
+		, config.loss
+		, config.latency * 1000
+		, config.jitter * 1000
+		, config.batch_io
+		, (unsigned long long)sent
+		, (unsigned long long)received
+		, (unsigned long long)(reliable_sent - reliable_received)
+		, (unsigned long long)(stats.sent[unreliable] - stats.received[unreliable])
+		, received / config.seconds
+		, stats.received_bytes / config.seconds
+		, percentile(stats.latencies, 0.5f)
+		, percentile(stats.latencies, 0.99f)
+		, stats.latencies.empty() ? 0 : stats.latencies.last()
+		, received ? cpu_time * 1e6 / received : 0.0);
+
+	for (ENetHost* host : hosts) host->intercept = nullptr;
+	for (Impairment* impairment : impairments) LUMIX_DELETE(allocator, impairment);
+	if (pump_socket != ENET_SOCKET_NULL) enet_socket_destroy(pump_socket);
+	for (ENetHost* client : clients) enet_host_destroy(client);
+	enet_host_destroy(server);
+	enet_deinitialize();
+	return reliable_sent == reliable_received ? 0 : 2;
+}
@@ -0,0 +1,206 @@
+// Measures bytes per client per tick of replication deltas. A part of entities moves every tick,
+// deltas and acks are delayed and randomly lost, clients decode everything they receive.
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/os.h"
+#include "core/stream.h"
+#include "replication.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Lumix;
+
+namespace {
+
+struct Random {
+	u32 next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	float nextFloat() { return (next() & 0xffFFff) / float(0x1000000); }
+	u32 state = 0x12345678;
+};
+
+struct Transform {
+	float pos[3];
+	float rot[4];
+};
+
+// game state of the server or of a client
+struct World {
+	World(IAllocator& allocator)
+		: transforms(allocator)
+		, health(allocator)
+	{}
+
+	void readTransform(EntityRef e, Span<u8> out) { memcpy(out.begin(), &transforms[e.index], sizeof(Transform)); }
+	void readHealth(EntityRef e, Span<u8> out) { memcpy(out.begin(), &health[e.index], sizeof(u32)); }
+	void writeTransform(EntityRef e, Span<const u8> in) { memcpy(&transforms[e.index], in.begin(), sizeof(Transform)); }
+	void writeHealth(EntityRef e, Span<const u8> in) { memcpy(&health[e.index], in.begin(), sizeof(u32)); }
+
+	void resize(u32 count) {
+		transforms.resize(count);
+		health.resize(count);
+		memset(transforms.begin(), 0, count * sizeof(Transform));
+		memset(health.begin(), 0, count * sizeof(u32));
+	}
+
+	Array<Transform> transforms;
+	Array<u32> health;
+};
+
+void registerFields(Replication& replication, World& world) {
+	Replication::ReadFn read_transform, read_health;
+	Replication::WriteFn write_transform, write_health;
+	read_transform.bind<&World::readTransform>(&world);
+	read_health.bind<&World::readHealth>(&world);
+	write_transform.bind<&World::writeTransform>(&world);
+	write_health.bind<&World::writeHealth>(&world);
+	replication.registerField("transform", sizeof(Transform), read_transform, write_transform);
+	replication.registerField("health", sizeof(u32), read_health, write_health);
+}
+
+struct Client {
+	Client(IAllocator& allocator)
+		: world(allocator)
+		, replication(allocator)
+		, acks(allocator)
+	{}
+
+	struct Ack {
+		u32 tick;
+		u32 arrival;
+	};
+
+	World world;
+	Replication replication;
+	Array<Ack> acks; // in flight to the server
+	u32 acked = 0; // as known by the server
+	u64 bytes = 0;
+};
+
+struct Config {
+	u32 entities;
+	float moving; // fraction of entities moving every tick
+	float damaged; // fraction of entities whose health changes every tick
+	u32 latency; // in ticks, each direction
+	float loss;
+};
+
+void run(IAllocator& allocator, const Config& cfg) {
+	constexpr u32 CLIENTS = 4;
+	constexpr u32 TICKS = 600;
+
+	Random rng;
+	World server_world(allocator);
+	Replication server(allocator);
+	registerFields(server, server_world);
+	server_world.resize(cfg.entities);
+	for (u32 i = 0; i < cfg.entities; ++i) {
+		server_world.health[i] = 100;
+		server.addEntity(EntityRef{(i32)i}, 0b11);
+	}
+
+	Array<Client*> clients(allocator);
+	for (u32 i = 0; i < CLIENTS; ++i) {
+		Client* client = LUMIX_NEW(allocator, Client)(allocator);
+		registerFields(client->replication, client->world);
+		client->world.resize(cfg.entities);
+		clients.push(client);
+	}
+
+	OutputMemoryStream blob(allocator);
+	server.captureSnapshot();
+	server.writeDelta(0, blob);
+	const u64 full_size = blob.size();
+
+	double encode_time = 0;
+	double decode_time = 0;
+	u32 decode_failures = 0;
+	for (u32 tick = 0; tick < TICKS; ++tick) {
+		for (u32 i = 0; i < cfg.entities; ++i) {
+			if (rng.nextFloat() < cfg.moving) {
+				Transform& tr = server_world.transforms[i];
+				tr.pos[0] += rng.nextFloat() - 0.5f;
+				tr.pos[2] += rng.nextFloat() - 0.5f;
+				tr.rot[1] = rng.nextFloat();
+			}
+			if (rng.nextFloat() < cfg.damaged) server_world.health[i] -= 1;
+		}
+		const u32 server_tick = server.captureSnapshot();
+
+		for (Client* client : clients) {
+			while (!client->acks.empty() && client->acks[0].arrival <= server_tick) {
+				if (client->acks[0].tick > client->acked) client->acked = client->acks[0].tick;
+				client->acks.erase(0);
+			}
+
+			blob.clear();
+			os::Timer timer;
+			server.writeDelta(client->acked, blob);
+			encode_time += timer.getTimeSinceStart();
+			client->bytes += blob.size();
+
+			// latency only delays acks, deltas are decoded right away, baselines are old enough anyway
+			if (rng.nextFloat() < cfg.loss) continue;
+			timer.tick();
+			InputMemoryStream in(blob.data(), blob.size());
+			u32 acked_tick;
+			const bool decoded = client->replication.readDelta(in, acked_tick);
+			decode_time += timer.getTimeSinceStart();
+			if (!decoded) {
+				++decode_failures;
+				continue;
+			}
+			if (rng.nextFloat() >= cfg.loss) client->acks.push({acked_tick, server_tick + 2 * cfg.latency});
+		}
+	}
+
+	// the last delta of a client may have been lost
+	u32 mismatches = 0;
+	for (Client* client : clients) {
+		blob.clear();
+		server.writeDelta(client->acked, blob);
+		InputMemoryStream in(blob.data(), blob.size());
+		u32 acked_tick;
+		if (!client->replication.readDelta(in, acked_tick)) ++decode_failures;
+		if (memcmp(client->world.transforms.begin(), server_world.transforms.begin(), cfg.entities * sizeof(Transform)) != 0) ++mismatches;
+		if (memcmp(client->world.health.begin(), server_world.health.begin(), cfg.entities * sizeof(u32)) != 0) ++mismatches;
+	}
+
+	u64 total_bytes = 0;
+	for (Client* client : clients) total_bytes += client->bytes;
+	const double deltas = double(TICKS) * CLIENTS;
+	printf("replication entities=%u moving=%.2f latency=%u loss=%.2f full_bytes=%llu bytes_per_client_tick=%.1f encode_us=%.2f decode_us=%.2f decode_failures=%u mismatches=%u\n"
+		, cfg.entities
+		, cfg.moving
+		, cfg.latency
+		, cfg.loss
+		, (unsigned long long)full_size
+		, total_bytes / deltas
+		, encode_time * 1e6 / deltas
+		, decode_time * 1e6 / deltas
+		, decode_failures
+		, mismatches);
+
+	for (Client* client : clients) LUMIX_DELETE(allocator, client);
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	DefaultAllocator allocator;
+	const Config configs[] = {
+		{1000, 0.1f, 0.01f, 3, 0.0f},
+		{1000, 0.1f, 0.01f, 3, 0.05f},
+		{1000, 1.0f, 0.01f, 3, 0.0f},
+		{10000, 0.1f, 0.01f, 3, 0.0f},
+		{10000, 0.1f, 0.01f, 3, 0.05f},
+		{10000, 1.0f, 0.01f, 3, 0.0f},
+	};
+	for (const Config& cfg : configs) run(allocator, cfg);
+	return 0;
+}
@@ -14,6 +14,8 @@
     @{
 */
 
+static ENetHost * enet_host_create_internal (const ENetAddress *, size_t, size_t, enet_uint32, enet_uint32, int);
+
 /** Creates a host for communicating to peers.  
 
     @param address   the address at which other peers may connect to this host.  If NULL, then no peers may connect to the host.
@@ -31,6 +33,23 @@
 */
 ENetHost *
 enet_host_create (const ENetAddress * address, size_t peerCount, size_t channelLimit, enet_uint32 incomingBandwidth, enet_uint32 outgoingBandwidth)
+{
+    return enet_host_create_internal (address, peerCount, channelLimit, incomingBandwidth, outgoingBandwidth, 0);
+}
+
+/** Creates a host whose socket is bound with ENET_SOCKOPT_REUSEPORT, so several hosts can be bound to the same port.
+    The kernel spreads incoming datagrams among them by a hash of the source address, so each remote peer talks to a single host.
+    Parameters are the same as for enet_host_create.
+    @returns the host on success and NULL on failure, including platforms without SO_REUSEPORT
+*/
+ENetHost *
+enet_host_create_reuse_port (const ENetAddress * address, size_t peerCount, size_t channelLimit, enet_uint32 incomingBandwidth, enet_uint32 outgoingBandwidth)
+{
+    return enet_host_create_internal (address, peerCount, channelLimit, incomingBandwidth, outgoingBandwidth, 1);
+}
+
+static ENetHost *
+enet_host_create_internal (const ENetAddress * address, size_t peerCount, size_t channelLimit, enet_uint32 incomingBandwidth, enet_uint32 outgoingBandwidth, int reusePort)
 {
     ENetHost * host;
     ENetPeer * currentPeer;
@@ -53,7 +72,9 @@ enet_host_create (const ENetAddress * address, size_t peerCount, size_t channelL
     memset (host -> peers, 0, peerCount * sizeof (ENetPeer));
 
     host -> socket = enet_socket_create (ENET_SOCKET_TYPE_DATAGRAM);
-    if (host -> socket == ENET_SOCKET_NULL || (address != NULL && enet_socket_bind (host -> socket, address) < 0))
+    if (host -> socket == ENET_SOCKET_NULL ||
+        (reusePort && enet_socket_set_option (host -> socket, ENET_SOCKOPT_REUSEPORT, 1) < 0) ||
+        (address != NULL && enet_socket_bind (host -> socket, address) < 0))
     {
        if (host -> socket != ENET_SOCKET_NULL)
          enet_socket_destroy (host -> socket);
@@ -115,6 +136,10 @@ enet_host_create (const ENetAddress * address, size_t peerCount, size_t channelL
 
     host -> intercept = NULL;
 
+    host -> receiveBatch = NULL;
+    host -> sendBatch = NULL;
+    host -> batchFlags = 0;
+
     enet_list_clear (& host -> dispatchQueue);
 
     for (currentPeer = host -> peers;
@@ -161,6 +186,11 @@ enet_host_destroy (ENetHost * host)
     if (host -> compressor.context != NULL && host -> compressor.destroy)
       (* host -> compressor.destroy) (host -> compressor.context);
 
+    if (host -> receiveBatch != NULL)
+      enet_free (host -> receiveBatch);
+    if (host -> sendBatch != NULL)
+      enet_free (host -> sendBatch);
+
     enet_free (host -> peers);
     enet_free (host);
 }
@@ -339,6 +369,74 @@ enet_host_bandwidth_limit (ENetHost * host, enet_uint32 incomingBandwidth, enet_
     host -> recalculateBandwidthLimits = 1;
 }
 
+static ENetSocketBatch *
+enet_host_batch_create (size_t capacity)
+{
+    ENetSocketBatch * batch;
+
+    if (capacity > ENET_HOST_BATCH_MAXIMUM)
+      capacity = ENET_HOST_BATCH_MAXIMUM;
+
+    batch = (ENetSocketBatch *) enet_malloc (sizeof (ENetSocketBatch) +
+                                             capacity * (sizeof (ENetBuffer) + sizeof (ENetAddress) + ENET_PROTOCOL_MAXIMUM_MTU));
+    if (batch == NULL)
+      return NULL;
+
+    batch -> capacity = capacity;
+    batch -> count = 0;
+    batch -> index = 0;
+    batch -> buffers = (ENetBuffer *) (batch + 1);
+    batch -> addresses = (ENetAddress *) (batch -> buffers + capacity);
+    batch -> data = (enet_uint8 *) (batch -> addresses + capacity);
+
+    return batch;
+}
+
+/** Configures batched socket I/O for a host.
+    @param host host to configure
+    @param receiveDatagrams maximum number of datagrams received with one system call, 0 to receive one datagram per call
+    @param sendDatagrams maximum number of datagrams sent with one system call, 0 to send one datagram per call
+    @param flags bitwise-or of ENetHostBatchFlag constants
+    @remarks batches are capped at ENET_HOST_BATCH_MAXIMUM datagrams; received datagrams which were not processed yet are dropped
+    @returns 0 on success, < 0 on failure
+*/
+int
+enet_host_batch_io (ENetHost * host, size_t receiveDatagrams, size_t sendDatagrams, enet_uint32 flags)
+{
+    if (host -> sendBatch != NULL)
+    {
+       if (host -> sendBatch -> count > 0)
+         enet_socket_send_batch (host -> socket, host -> sendBatch -> addresses, host -> sendBatch -> buffers, host -> sendBatch -> count, & host -> batchFlags);
+
+       enet_free (host -> sendBatch);
+       host -> sendBatch = NULL;
+    }
+
+    if (host -> receiveBatch != NULL)
+    {
+       enet_free (host -> receiveBatch);
+       host -> receiveBatch = NULL;
+    }
+
+    host -> batchFlags = flags;
+
+    if (receiveDatagrams > 1)
+    {
+       host -> receiveBatch = enet_host_batch_create (receiveDatagrams);
+       if (host -> receiveBatch == NULL)
+         return -1;
+    }
+
+    if (sendDatagrams > 1)
+    {
+       host -> sendBatch = enet_host_batch_create (sendDatagrams);
+       if (host -> sendBatch == NULL)
+         return -1;
+    }
+
+    return 0;
+}
+
 void
 enet_host_bandwidth_throttle (ENetHost * host)
 {
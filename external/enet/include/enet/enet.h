@@ -58,9 +58,14 @@ typedef enum _ENetSocketOption
    ENET_SOCKOPT_SNDTIMEO  = 7,
    ENET_SOCKOPT_ERROR     = 8,
    ENET_SOCKOPT_NODELAY   = 9,
-   ENET_SOCKOPT_TTL       = 10
+   ENET_SOCKOPT_TTL       = 10,
+   ENET_SOCKOPT_REUSEPORT = 11
 } ENetSocketOption;
 
+/** Set of sockets to wait on at once, with a wake-up usable from other threads.
+    Uses epoll and eventfd on Linux, select elsewhere with at most 63 sockets. */
+typedef struct _ENetSocketPoller ENetSocketPoller;
+
 typedef enum _ENetSocketShutdown
 {
     ENET_SOCKET_SHUTDOWN_READ       = 0,
@@ -230,9 +235,35 @@ enum
    ENET_PEER_FREE_UNSEQUENCED_WINDOWS     = 32,
    ENET_PEER_RELIABLE_WINDOWS             = 16,
    ENET_PEER_RELIABLE_WINDOW_SIZE         = 0x1000,
-   ENET_PEER_FREE_RELIABLE_WINDOWS        = 8
+   ENET_PEER_FREE_RELIABLE_WINDOWS        = 8,
+
+   ENET_HOST_BATCH_MAXIMUM                = 64
 };
 
+typedef enum _ENetHostBatchFlag
+{
+   /** coalesce consecutive datagrams to the same peer into one UDP GSO send, where supported */
+   ENET_HOST_BATCH_FLAG_SEGMENTATION = (1 << 0)
+} ENetHostBatchFlag;
+
+/**
+ * Staging area for batched datagram I/O.
+ *
+ * Received datagrams are processed one by one from the batch, outgoing datagrams
+ * are copied into it and flushed with a single system call where the platform allows.
+
+   @sa enet_host_batch_io()
+ */
+typedef struct _ENetSocketBatch
+{
+   size_t        capacity;   /**< maximum number of datagrams in the batch */
+   size_t        count;      /**< number of datagrams in the batch */
+   size_t        index;      /**< next datagram to be processed, receive batches only */
+   ENetBuffer *  buffers;
+   ENetAddress * addresses;
+   enet_uint8 *  data;       /**< capacity * ENET_PROTOCOL_MAXIMUM_MTU bytes */
+} ENetSocketBatch;
+
 typedef struct _ENetChannel
 {
    enet_uint16  outgoingReliableSequenceNumber;
@@ -318,6 +349,12 @@ typedef struct _ENetPeer
    enet_uint32   unsequencedWindow [ENET_PEER_UNSEQUENCED_WINDOW_SIZE / 32]; 
    enet_uint32   eventData;
    size_t        totalWaitingData;
+   enet_uint32   totalDataSent;            /**< bytes of datagrams sent to the peer, never reset by throttling, wraps around */
+   enet_uint32   totalDataReceived;        /**< bytes of datagrams received from the peer, wraps around */
+   enet_uint32   totalPacketsSent;         /**< datagrams sent to the peer, wraps around */
+   enet_uint32   totalPacketsReceived;     /**< datagrams received from the peer, wraps around */
+   enet_uint32   totalResends;             /**< reliable commands sent again after their acknowledgement timed out */
+   enet_uint32   reliableCommandsPending;  /**< reliable commands queued or sent and not acknowledged yet */
 } ENetPeer;
 
 /** An ENet packet compressor for compressing UDP packets before socket sends or receives.
@@ -394,6 +431,9 @@ typedef struct _ENetHost
    size_t               duplicatePeers;              /**< optional number of allowed peers from duplicate IPs, defaults to ENET_PROTOCOL_MAXIMUM_PEER_ID */
    size_t               maximumPacketSize;           /**< the maximum allowable packet size that may be sent or received on a peer */
    size_t               maximumWaitingData;          /**< the maximum aggregate amount of buffer space a peer may use waiting for packets to be delivered */
+   ENetSocketBatch *    receiveBatch;                /**< batched receives, NULL to receive one datagram per system call */
+   ENetSocketBatch *    sendBatch;                   /**< batched sends, NULL to send one datagram per system call */
+   enet_uint32          batchFlags;                  /**< bitwise-or of ENetHostBatchFlag constants, segmentation is dropped once the socket rejects it */
 } ENetHost;
 
 /**
@@ -439,6 +479,7 @@ typedef struct _ENetEvent
    enet_uint8           channelID; /**< channel on the peer that generated the event, if appropriate */
    enet_uint32          data;      /**< data associated with the event, if appropriate */
    ENetPacket *         packet;    /**< packet associated with the event, if appropriate */
+   enet_uint32          connectID; /**< connectID of the peer when the event was generated, the peer is already reset on disconnect */
 } ENetEvent;
 
 #ifdef __cplusplus
@@ -509,6 +550,24 @@ ENET_API int        enet_socket_get_option (ENetSocket, ENetSocketOption, int *)
 ENET_API int        enet_socket_shutdown (ENetSocket, ENetSocketShutdown);
 ENET_API void       enet_socket_destroy (ENetSocket);
 ENET_API int        enet_socketset_select (ENetSocket, ENetSocketSet *, ENetSocketSet *, enet_uint32);
+/** Receives up to bufferCount datagrams, one per buffer. Each buffer's dataLength is set to the received length, 0 for truncated datagrams.
+    @returns number of received datagrams, 0 if none are pending, < 0 on failure */
+ENET_API int        enet_socket_receive_batch (ENetSocket, ENetAddress *, ENetBuffer *, size_t);
+/** Sends bufferCount datagrams, one per buffer, to the matching addresses.
+    flags points to ENetHostBatchFlag constants, may be NULL; ENET_HOST_BATCH_FLAG_SEGMENTATION is cleared when the socket does not support it.
+    @returns number of sent datagrams, < 0 on failure */
+ENET_API int        enet_socket_send_batch (ENetSocket, const ENetAddress *, const ENetBuffer *, size_t, enet_uint32 *);
+ENET_API ENetSocketPoller * enet_socket_poller_create (void);
+ENET_API void       enet_socket_poller_destroy (ENetSocketPoller *);
+/** @returns 0 on success, < 0 on failure or if the poller is full */
+ENET_API int        enet_socket_poller_add (ENetSocketPoller *, ENetSocket);
+ENET_API int        enet_socket_poller_remove (ENetSocketPoller *, ENetSocket);
+/** Waits until a socket of the poller has data to receive, the poller is woken up or the timeout in milliseconds expires.
+    @returns > 0 if a socket is readable or the poller was woken up, 0 on timeout or interruption, < 0 on failure */
+ENET_API int        enet_socket_poller_wait (ENetSocketPoller *, enet_uint32);
+/** Makes the current or the next enet_socket_poller_wait return, can be called from any thread.
+    @returns 0 on success, < 0 on failure */
+ENET_API int        enet_socket_poller_wake (ENetSocketPoller *);
 
 /** @} */
 
@@ -564,16 +623,19 @@ ENET_API int          enet_packet_resize  (ENetPacket *, size_t);
 ENET_API enet_uint32  enet_crc32 (const ENetBuffer *, size_t);
                 
 ENET_API ENetHost * enet_host_create (const ENetAddress *, size_t, size_t, enet_uint32, enet_uint32);
+ENET_API ENetHost * enet_host_create_reuse_port (const ENetAddress *, size_t, size_t, enet_uint32, enet_uint32);
 ENET_API void       enet_host_destroy (ENetHost *);
 ENET_API ENetPeer * enet_host_connect (ENetHost *, const ENetAddress *, size_t, enet_uint32);
 ENET_API int        enet_host_check_events (ENetHost *, ENetEvent *);
 ENET_API int        enet_host_service (ENetHost *, ENetEvent *, enet_uint32);
+ENET_API enet_uint32 enet_host_service_timeout (ENetHost *, enet_uint32);
 ENET_API void       enet_host_flush (ENetHost *);
 ENET_API void       enet_host_broadcast (ENetHost *, enet_uint8, ENetPacket *);
 ENET_API void       enet_host_compress (ENetHost *, const ENetCompressor *);
 ENET_API int        enet_host_compress_with_range_coder (ENetHost * host);
 ENET_API void       enet_host_channel_limit (ENetHost *, size_t);
 ENET_API void       enet_host_bandwidth_limit (ENetHost *, enet_uint32, enet_uint32);
+ENET_API int        enet_host_batch_io (ENetHost *, size_t, size_t, enet_uint32);
 extern   void       enet_host_bandwidth_throttle (ENetHost *);
 extern  enet_uint32 enet_host_random_seed (void);
 extern  enet_uint32 enet_host_random (ENetHost *);
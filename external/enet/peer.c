@@ -269,6 +269,10 @@ enet_peer_reset_outgoing_commands (ENetPeer * peer, ENetList * queue)
     {
        outgoingCommand = (ENetOutgoingCommand *) enet_list_remove (enet_list_begin (queue));
 
+       if ((outgoingCommand -> command.header.command & ENET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE) != 0 &&
+           peer -> reliableCommandsPending > 0)
+         -- peer -> reliableCommandsPending;
+
        if (outgoingCommand -> packet != NULL)
        {
           -- outgoingCommand -> packet -> referenceCount;
@@ -436,11 +440,18 @@ enet_peer_reset (ENetPeer * peer)
     peer -> outgoingUnsequencedGroup = 0;
     peer -> eventData = 0;
     peer -> totalWaitingData = 0;
+    peer -> totalDataSent = 0;
+    peer -> totalDataReceived = 0;
+    peer -> totalPacketsSent = 0;
+    peer -> totalPacketsReceived = 0;
+    peer -> totalResends = 0;
     peer -> flags = 0;
 
     memset (peer -> unsequencedWindow, 0, sizeof (peer -> unsequencedWindow));
     
     enet_peer_reset_queues (peer);
+
+    peer -> reliableCommandsPending = 0;
 }
 
 /** Sends a ping request to a peer.
@@ -689,6 +700,9 @@ enet_peer_setup_outgoing_command (ENetPeer * peer, ENetOutgoingCommand * outgoin
     outgoingCommand -> command.header.reliableSequenceNumber = ENET_HOST_TO_NET_16 (outgoingCommand -> reliableSequenceNumber);
     outgoingCommand -> queueTime = ++ peer -> host -> totalQueued;
 
+    if (outgoingCommand -> command.header.command & ENET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE)
+      ++ peer -> reliableCommandsPending;
+
     switch (outgoingCommand -> command.header.command & ENET_PROTOCOL_COMMAND_MASK)
     {
     case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE:
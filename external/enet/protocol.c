@@ -78,6 +78,7 @@ enet_protocol_dispatch_incoming_commands (ENetHost * host, ENetEvent * event)
 
            event -> type = ENET_EVENT_TYPE_CONNECT;
            event -> peer = peer;
+           event -> connectID = peer -> connectID;
            event -> data = peer -> eventData;
 
            return 1;
@@ -87,6 +88,7 @@ enet_protocol_dispatch_incoming_commands (ENetHost * host, ENetEvent * event)
 
            event -> type = ENET_EVENT_TYPE_DISCONNECT;
            event -> peer = peer;
+           event -> connectID = peer -> connectID;
            event -> data = peer -> eventData;
 
            enet_peer_reset (peer);
@@ -103,6 +105,7 @@ enet_protocol_dispatch_incoming_commands (ENetHost * host, ENetEvent * event)
              
            event -> type = ENET_EVENT_TYPE_RECEIVE;
            event -> peer = peer;
+           event -> connectID = peer -> connectID;
 
            if (! enet_list_empty (& peer -> dispatchedCommands))
            {
@@ -132,6 +135,7 @@ enet_protocol_notify_connect (ENetHost * host, ENetPeer * peer, ENetEvent * even
 
         event -> type = ENET_EVENT_TYPE_CONNECT;
         event -> peer = peer;
+        event -> connectID = peer -> connectID;
         event -> data = peer -> eventData;
     }
     else 
@@ -151,6 +155,7 @@ enet_protocol_notify_disconnect (ENetHost * host, ENetPeer * peer, ENetEvent * e
     {
         event -> type = ENET_EVENT_TYPE_DISCONNECT;
         event -> peer = peer;
+        event -> connectID = peer -> connectID;
         event -> data = 0;
 
         enet_peer_reset (peer);
@@ -269,6 +274,9 @@ enet_protocol_remove_sent_reliable_command (ENetPeer * peer, enet_uint16 reliabl
     
     enet_list_remove (& outgoingCommand -> outgoingCommandList);
 
+    if (peer -> reliableCommandsPending > 0)
+      -- peer -> reliableCommandsPending;
+
     if (outgoingCommand -> packet != NULL)
     {
        if (wasSent)
@@ -1100,6 +1108,8 @@ enet_protocol_handle_incoming_commands (ENetHost * host, ENetEvent * event)
        peer -> address.host = host -> receivedAddress.host;
        peer -> address.port = host -> receivedAddress.port;
        peer -> incomingDataTotal += host -> receivedDataLength;
+       peer -> totalDataReceived += host -> receivedDataLength;
+       ++ peer -> totalPacketsReceived;
     }
     
     currentData = host -> receivedData + headerSize;
@@ -1235,6 +1245,45 @@ commandError:
     return 0;
 }
  
+static int
+enet_protocol_receive_batched (ENetHost * host)
+{
+    ENetSocketBatch * batch = host -> receiveBatch;
+    ENetBuffer * buffer;
+
+    if (batch -> index >= batch -> count)
+    {
+       int receivedCount;
+       size_t i;
+
+       for (i = 0; i < batch -> capacity; ++ i)
+       {
+          batch -> buffers [i].data = & batch -> data [i * ENET_PROTOCOL_MAXIMUM_MTU];
+          batch -> buffers [i].dataLength = ENET_PROTOCOL_MAXIMUM_MTU;
+       }
+
+       batch -> index = 0;
+       batch -> count = 0;
+
+       receivedCount = enet_socket_receive_batch (host -> socket, batch -> addresses, batch -> buffers, batch -> capacity);
+       if (receivedCount <= 0)
+         return receivedCount;
+
+       batch -> count = receivedCount;
+    }
+
+    buffer = & batch -> buffers [batch -> index];
+    host -> receivedAddress = batch -> addresses [batch -> index];
+    ++ batch -> index;
+
+    if (buffer -> dataLength == 0)
+      return -2;
+
+    host -> receivedData = (enet_uint8 *) buffer -> data;
+
+    return (int) buffer -> dataLength;
+}
+
 static int
 enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
 {
@@ -1245,13 +1294,20 @@ enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
        int receivedLength;
        ENetBuffer buffer;
 
-       buffer.data = host -> packetData [0];
-       buffer.dataLength = sizeof (host -> packetData [0]);
+       if (host -> receiveBatch != NULL)
+         receivedLength = enet_protocol_receive_batched (host);
+       else
+       {
+          buffer.data = host -> packetData [0];
+          buffer.dataLength = sizeof (host -> packetData [0]);
 
-       receivedLength = enet_socket_receive (host -> socket,
-                                             & host -> receivedAddress,
-                                             & buffer,
-                                             1);
+          receivedLength = enet_socket_receive (host -> socket,
+                                                & host -> receivedAddress,
+                                                & buffer,
+                                                1);
+
+          host -> receivedData = host -> packetData [0];
+       }
 
        if (receivedLength == -2)
          continue;
@@ -1262,7 +1318,6 @@ enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
        if (receivedLength == 0)
          return 0;
 
-       host -> receivedData = host -> packetData [0];
        host -> receivedDataLength = receivedLength;
       
        host -> totalReceivedData += receivedLength;
@@ -1389,6 +1444,7 @@ enet_protocol_check_timeouts (ENetHost * host, ENetPeer * peer, ENetEvent * even
        }
 
        ++ peer -> packetsLost;
+       ++ peer -> totalResends;
 
        outgoingCommand -> roundTripTimeout *= 2;
 
@@ -1603,6 +1659,48 @@ enet_protocol_check_outgoing_commands (ENetHost * host, ENetPeer * peer, ENetLis
     return canPing;
 }
 
+static int
+enet_protocol_flush_batched (ENetHost * host)
+{
+    ENetSocketBatch * batch = host -> sendBatch;
+    int sentCount;
+
+    if (batch == NULL || batch -> count == 0)
+      return 0;
+
+    sentCount = enet_socket_send_batch (host -> socket, batch -> addresses, batch -> buffers, batch -> count, & host -> batchFlags);
+    batch -> count = 0;
+
+    return sentCount < 0 ? -1 : 0;
+}
+
+static int
+enet_protocol_queue_batched (ENetHost * host, const ENetAddress * address)
+{
+    ENetSocketBatch * batch = host -> sendBatch;
+    enet_uint8 * data;
+    size_t i, length = 0;
+
+    if (batch -> count >= batch -> capacity &&
+        enet_protocol_flush_batched (host) < 0)
+      return -1;
+
+    /* the buffers reference packets which may be freed right after sending, so the datagram is copied */
+    data = & batch -> data [batch -> count * ENET_PROTOCOL_MAXIMUM_MTU];
+    for (i = 0; i < host -> bufferCount; ++ i)
+    {
+       memcpy (data + length, host -> buffers [i].data, host -> buffers [i].dataLength);
+       length += host -> buffers [i].dataLength;
+    }
+
+    batch -> addresses [batch -> count] = * address;
+    batch -> buffers [batch -> count].data = data;
+    batch -> buffers [batch -> count].dataLength = length;
+    ++ batch -> count;
+
+    return (int) length;
+}
+
 static int
 enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int checkForTimeouts)
 {
@@ -1640,7 +1738,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
             enet_protocol_check_timeouts (host, currentPeer, event) == 1)
         {
             if (event != NULL && event -> type != ENET_EVENT_TYPE_NONE)
-              return 1;
+              return enet_protocol_flush_batched (host) < 0 ? -1 : 1;
             else
               goto nextPeer;
         }
@@ -1731,7 +1829,10 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
 
         currentPeer -> lastSendTime = host -> serviceTime;
 
-        sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
+        if (host -> sendBatch != NULL)
+          sentLength = enet_protocol_queue_batched (host, & currentPeer -> address);
+        else
+          sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
 
         enet_protocol_remove_sent_unreliable_commands (currentPeer, & sentUnreliableCommands);
 
@@ -1741,12 +1842,15 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
         host -> totalSentData += sentLength;
         host -> totalSentPackets ++;
 
+        currentPeer -> totalDataSent += sentLength;
+        currentPeer -> totalPacketsSent ++;
+
     nextPeer:
         if (currentPeer -> flags & ENET_PEER_FLAG_CONTINUE_SENDING)
           continueSending = sendPass + 1;
     }
    
-    return 0;
+    return enet_protocol_flush_batched (host);
 }
 
 /** Sends any queued packets on the host specified to its designated peers.
@@ -1780,10 +1884,57 @@ enet_host_check_events (ENetHost * host, ENetEvent * event)
     event -> type = ENET_EVENT_TYPE_NONE;
     event -> peer = NULL;
     event -> packet = NULL;
+    event -> connectID = 0;
 
     return enet_protocol_dispatch_incoming_commands (host, event);
 }
 
+/** Computes how long the host may wait for incoming datagrams before enet_host_service has to be called
+    again to resend reliable commands, ping peers or dispatch queued events.
+
+    @param host           host to check
+    @param maximumTimeout upper bound of the result in milliseconds
+    @returns milliseconds until the host needs servicing, 0 if it needs it now
+    @remarks peers blocked by the reliable window or bandwidth limits are unblocked by incoming acknowledgements
+    @ingroup host
+*/
+enet_uint32
+enet_host_service_timeout (ENetHost * host, enet_uint32 maximumTimeout)
+{
+    enet_uint32 timeCurrent = enet_time_get (),
+                timeout = maximumTimeout,
+                deadline;
+    ENetPeer * currentPeer;
+
+    if (! enet_list_empty (& host -> dispatchQueue))
+      return 0;
+
+    for (currentPeer = host -> peers;
+         currentPeer < & host -> peers [host -> peerCount];
+         ++ currentPeer)
+    {
+        if (currentPeer -> state == ENET_PEER_STATE_DISCONNECTED ||
+            currentPeer -> state == ENET_PEER_STATE_ZOMBIE)
+          continue;
+
+        if (! enet_list_empty (& currentPeer -> acknowledgements))
+          return 0;
+
+        if (! enet_list_empty (& currentPeer -> sentReliableCommands))
+          deadline = currentPeer -> nextTimeout;
+        else
+          deadline = currentPeer -> lastReceiveTime + currentPeer -> pingInterval;
+
+        if (ENET_TIME_LESS_EQUAL (deadline, timeCurrent))
+          return 0;
+
+        if (ENET_TIME_DIFFERENCE (deadline, timeCurrent) < timeout)
+          timeout = ENET_TIME_DIFFERENCE (deadline, timeCurrent);
+    }
+
+    return timeout;
+}
+
 /** Waits for events on the host specified and shuttles packets between
     the host and its peers.
 
@@ -1807,6 +1958,7 @@ enet_host_service (ENetHost * host, ENetEvent * event, enet_uint32 timeout)
         event -> type = ENET_EVENT_TYPE_NONE;
         event -> peer = NULL;
         event -> packet = NULL;
+        event -> connectID = 0;
 
         switch (enet_protocol_dispatch_incoming_commands (host, event))
         {
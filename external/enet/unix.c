@@ -4,6 +4,10 @@
 */
 #ifndef _WIN32
 
+#if defined(__linux__) && ! defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -53,6 +57,28 @@
 #include <poll.h>
 #endif
 
+#ifdef __linux__
+#define HAS_MMSG 1
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#define ENET_UDP_SEGMENT_MAXIMUM 64
+#define ENET_UDP_SEGMENT_PAYLOAD_MAXIMUM 65000
+#define HAS_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAS_EPOLL
+#define ENET_SOCKET_POLLER_EVENTS 16
+#else
+#define ENET_SOCKET_POLLER_MAXIMUM 63
+#endif
+
 #if !defined(HAS_SOCKLEN_T) && !defined(__socklen_t_defined)
 typedef int socklen_t;
 #endif
@@ -318,6 +344,12 @@ enet_socket_set_option (ENetSocket socket, ENetSocketOption option, int value)
             result = setsockopt (socket, SOL_SOCKET, SO_REUSEADDR, (char *) & value, sizeof (int));
             break;
 
+        case ENET_SOCKOPT_REUSEPORT:
+#ifdef SO_REUSEPORT
+            result = setsockopt (socket, SOL_SOCKET, SO_REUSEPORT, (char *) & value, sizeof (int));
+#endif
+            break;
+
         case ENET_SOCKOPT_RCVBUF:
             result = setsockopt (socket, SOL_SOCKET, SO_RCVBUF, (char *) & value, sizeof (int));
             break;
@@ -527,6 +559,213 @@ enet_socket_receive (ENetSocket socket,
     return recvLength;
 }
 
+#ifdef HAS_MMSG
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t bufferCount)
+{
+    struct mmsghdr msgHdrs [ENET_HOST_BATCH_MAXIMUM];
+    struct sockaddr_in sins [ENET_HOST_BATCH_MAXIMUM];
+    int recvCount, i;
+
+    if (bufferCount > ENET_HOST_BATCH_MAXIMUM)
+      bufferCount = ENET_HOST_BATCH_MAXIMUM;
+
+    memset (msgHdrs, 0, sizeof (struct mmsghdr) * bufferCount);
+
+    for (i = 0; i < (int) bufferCount; ++ i)
+    {
+        msgHdrs [i].msg_hdr.msg_name = & sins [i];
+        msgHdrs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+        msgHdrs [i].msg_hdr.msg_iov = (struct iovec *) & buffers [i];
+        msgHdrs [i].msg_hdr.msg_iovlen = 1;
+    }
+
+    recvCount = recvmmsg (socket, msgHdrs, (unsigned int) bufferCount, MSG_NOSIGNAL, NULL);
+
+    if (recvCount == -1)
+    {
+        switch (errno)
+        {
+            case EWOULDBLOCK:
+            case EINTR:
+                return 0;
+            default:
+                return -1;
+        }
+    }
+
+    for (i = 0; i < recvCount; ++ i)
+    {
+        /* truncated datagrams are skipped by the caller */
+        if (msgHdrs [i].msg_hdr.msg_flags & MSG_TRUNC)
+          buffers [i].dataLength = 0;
+        else
+          buffers [i].dataLength = msgHdrs [i].msg_len;
+
+        addresses [i].host = (enet_uint32) sins [i].sin_addr.s_addr;
+        addresses [i].port = ENET_NET_TO_HOST_16 (sins [i].sin_port);
+    }
+
+    return recvCount;
+}
+
+static size_t
+enet_socket_segment_count (const ENetAddress * addresses, const ENetBuffer * buffers, size_t first, size_t bufferCount)
+{
+    size_t segmentCount = 1;
+
+    /* UDP GSO splits the payload into equally sized segments, only the last one may be shorter */
+    while (first + segmentCount < bufferCount &&
+           segmentCount < ENET_UDP_SEGMENT_MAXIMUM &&
+           (segmentCount + 1) * buffers [first].dataLength <= ENET_UDP_SEGMENT_PAYLOAD_MAXIMUM &&
+           addresses [first + segmentCount].host == addresses [first].host &&
+           addresses [first + segmentCount].port == addresses [first].port &&
+           buffers [first + segmentCount - 1].dataLength == buffers [first].dataLength &&
+           buffers [first + segmentCount].dataLength <= buffers [first].dataLength)
+      ++ segmentCount;
+
+    return segmentCount;
+}
+
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t bufferCount,
+                        enet_uint32 * flags)
+{
+    struct mmsghdr msgHdrs [ENET_HOST_BATCH_MAXIMUM];
+    struct sockaddr_in sins [ENET_HOST_BATCH_MAXIMUM];
+    char controls [ENET_HOST_BATCH_MAXIMUM][CMSG_SPACE (sizeof (enet_uint16))];
+    size_t datagramCounts [ENET_HOST_BATCH_MAXIMUM];
+    size_t msgCount = 0, buffer = 0, sentDatagrams = 0, sentMsgs = 0;
+    int segment = flags != NULL && (* flags & ENET_HOST_BATCH_FLAG_SEGMENTATION);
+
+    if (bufferCount > ENET_HOST_BATCH_MAXIMUM)
+      bufferCount = ENET_HOST_BATCH_MAXIMUM;
+
+    memset (msgHdrs, 0, sizeof (struct mmsghdr) * bufferCount);
+
+    while (buffer < bufferCount)
+    {
+        struct msghdr * msgHdr = & msgHdrs [msgCount].msg_hdr;
+        struct sockaddr_in * sin = & sins [msgCount];
+        size_t segmentCount = segment ? enet_socket_segment_count (addresses, buffers, buffer, bufferCount) : 1;
+
+        memset (sin, 0, sizeof (struct sockaddr_in));
+        sin -> sin_family = AF_INET;
+        sin -> sin_port = ENET_HOST_TO_NET_16 (addresses [buffer].port);
+        sin -> sin_addr.s_addr = addresses [buffer].host;
+
+        msgHdr -> msg_name = sin;
+        msgHdr -> msg_namelen = sizeof (struct sockaddr_in);
+        msgHdr -> msg_iov = (struct iovec *) & buffers [buffer];
+        msgHdr -> msg_iovlen = segmentCount;
+
+        if (segmentCount > 1)
+        {
+            struct cmsghdr * cmsg;
+            enet_uint16 segmentSize = (enet_uint16) buffers [buffer].dataLength;
+
+            msgHdr -> msg_control = controls [msgCount];
+            msgHdr -> msg_controllen = sizeof (controls [msgCount]);
+            cmsg = CMSG_FIRSTHDR (msgHdr);
+            cmsg -> cmsg_level = SOL_UDP;
+            cmsg -> cmsg_type = UDP_SEGMENT;
+            cmsg -> cmsg_len = CMSG_LEN (sizeof (enet_uint16));
+            memcpy (CMSG_DATA (cmsg), & segmentSize, sizeof (enet_uint16));
+        }
+
+        datagramCounts [msgCount] = segmentCount;
+        buffer += segmentCount;
+        ++ msgCount;
+    }
+
+    while (sentMsgs < msgCount)
+    {
+        int sentCount = sendmmsg (socket, & msgHdrs [sentMsgs], (unsigned int) (msgCount - sentMsgs), MSG_NOSIGNAL);
+
+        if (sentCount == -1)
+        {
+            if (errno == EWOULDBLOCK)
+              break;
+
+            if (segment && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT))
+            {
+                /* kernel or device without UDP GSO, resend the rest one datagram per message */
+                int restCount;
+
+                * flags &= ~ ENET_HOST_BATCH_FLAG_SEGMENTATION;
+                restCount = enet_socket_send_batch (socket,
+                                                    & addresses [sentDatagrams],
+                                                    & buffers [sentDatagrams],
+                                                    bufferCount - sentDatagrams,
+                                                    NULL);
+                return restCount < 0 ? -1 : (int) sentDatagrams + restCount;
+            }
+
+            return -1;
+        }
+
+        for (; sentCount > 0; -- sentCount, ++ sentMsgs)
+          sentDatagrams += datagramCounts [sentMsgs];
+    }
+
+    return (int) sentDatagrams;
+}
+#else
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t bufferCount)
+{
+    size_t i;
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        int recvLength = enet_socket_receive (socket, & addresses [i], & buffers [i], 1);
+
+        if (recvLength == -2)
+        {
+            buffers [i].dataLength = 0;
+            continue;
+        }
+
+        if (recvLength < 0)
+          return i > 0 ? (int) i : -1;
+
+        if (recvLength == 0)
+          break;
+
+        buffers [i].dataLength = recvLength;
+    }
+
+    return (int) i;
+}
+
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t bufferCount,
+                        enet_uint32 * flags)
+{
+    size_t i;
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        if (enet_socket_send (socket, & addresses [i], & buffers [i], 1) < 0)
+          return -1;
+    }
+
+    return (int) bufferCount;
+}
+#endif
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
@@ -626,5 +865,189 @@ enet_socket_wait (ENetSocket socket, enet_uint32 * condition, enet_uint32 timeou
 #endif
 }
 
+struct _ENetSocketPoller
+{
+#ifdef HAS_EPOLL
+    int epoll;
+    int wakeEvent;
+#else
+    ENetSocket sockets [ENET_SOCKET_POLLER_MAXIMUM];
+    size_t socketCount;
+    int wakePipe [2];
+#endif
+};
+
+ENetSocketPoller *
+enet_socket_poller_create (void)
+{
+    ENetSocketPoller * poller = (ENetSocketPoller *) enet_malloc (sizeof (ENetSocketPoller));
+#ifdef HAS_EPOLL
+    struct epoll_event event;
+#endif
+
+    if (poller == NULL)
+      return NULL;
+
+#ifdef HAS_EPOLL
+    poller -> epoll = epoll_create1 (EPOLL_CLOEXEC);
+    poller -> wakeEvent = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    memset (& event, 0, sizeof (event));
+    event.events = EPOLLIN;
+    event.data.fd = poller -> wakeEvent;
+
+    if (poller -> epoll < 0 ||
+        poller -> wakeEvent < 0 ||
+        epoll_ctl (poller -> epoll, EPOLL_CTL_ADD, poller -> wakeEvent, & event) < 0)
+    {
+       enet_socket_poller_destroy (poller);
+
+       return NULL;
+    }
+#else
+    poller -> socketCount = 0;
+
+    if (pipe (poller -> wakePipe) < 0)
+    {
+       enet_free (poller);
+
+       return NULL;
+    }
+
+    enet_socket_set_option (poller -> wakePipe [0], ENET_SOCKOPT_NONBLOCK, 1);
+    enet_socket_set_option (poller -> wakePipe [1], ENET_SOCKOPT_NONBLOCK, 1);
+#endif
+
+    return poller;
+}
+
+void
+enet_socket_poller_destroy (ENetSocketPoller * poller)
+{
+#ifdef HAS_EPOLL
+    if (poller -> epoll >= 0)
+      close (poller -> epoll);
+    if (poller -> wakeEvent >= 0)
+      close (poller -> wakeEvent);
+#else
+    close (poller -> wakePipe [0]);
+    close (poller -> wakePipe [1]);
+#endif
+
+    enet_free (poller);
+}
+
+int
+enet_socket_poller_add (ENetSocketPoller * poller, ENetSocket socket)
+{
+#ifdef HAS_EPOLL
+    struct epoll_event event;
+
+    memset (& event, 0, sizeof (event));
+    event.events = EPOLLIN;
+    event.data.fd = socket;
+
+    return epoll_ctl (poller -> epoll, EPOLL_CTL_ADD, socket, & event) < 0 ? -1 : 0;
+#else
+    if (poller -> socketCount >= ENET_SOCKET_POLLER_MAXIMUM || socket >= FD_SETSIZE)
+      return -1;
+
+    poller -> sockets [poller -> socketCount ++] = socket;
+
+    return 0;
+#endif
+}
+
+int
+enet_socket_poller_remove (ENetSocketPoller * poller, ENetSocket socket)
+{
+#ifdef HAS_EPOLL
+    return epoll_ctl (poller -> epoll, EPOLL_CTL_DEL, socket, NULL) < 0 ? -1 : 0;
+#else
+    size_t i;
+
+    for (i = 0; i < poller -> socketCount; ++ i)
+    {
+       if (poller -> sockets [i] != socket)
+         continue;
+
+       poller -> sockets [i] = poller -> sockets [-- poller -> socketCount];
+
+       return 0;
+    }
+
+    return -1;
+#endif
+}
+
+int
+enet_socket_poller_wait (ENetSocketPoller * poller, enet_uint32 timeout)
+{
+#ifdef HAS_EPOLL
+    struct epoll_event events [ENET_SOCKET_POLLER_EVENTS];
+    eventfd_t value;
+    int eventCount, i;
+
+    eventCount = epoll_wait (poller -> epoll, events, ENET_SOCKET_POLLER_EVENTS, (int) timeout);
+    if (eventCount < 0)
+      return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < eventCount; ++ i)
+    {
+       if (events [i].data.fd == poller -> wakeEvent)
+         eventfd_read (poller -> wakeEvent, & value);
+    }
+
+    return eventCount;
+#else
+    fd_set readSet;
+    struct timeval timeVal;
+    int selectCount, maximumSocket = poller -> wakePipe [0];
+    char drain [64];
+    size_t i;
+
+    timeVal.tv_sec = timeout / 1000;
+    timeVal.tv_usec = (timeout % 1000) * 1000;
+
+    FD_ZERO (& readSet);
+    FD_SET (poller -> wakePipe [0], & readSet);
+
+    for (i = 0; i < poller -> socketCount; ++ i)
+    {
+       FD_SET (poller -> sockets [i], & readSet);
+       if (poller -> sockets [i] > maximumSocket)
+         maximumSocket = poller -> sockets [i];
+    }
+
+    selectCount = select (maximumSocket + 1, & readSet, NULL, NULL, & timeVal);
+    if (selectCount < 0)
+      return errno == EINTR ? 0 : -1;
+
+    if (selectCount > 0 && FD_ISSET (poller -> wakePipe [0], & readSet))
+    {
+       while (read (poller -> wakePipe [0], drain, sizeof (drain)) > 0)
+         ;
+    }
+
+    return selectCount;
+#endif
+}
+
+int
+enet_socket_poller_wake (ENetSocketPoller * poller)
+{
+#ifdef HAS_EPOLL
+    return eventfd_write (poller -> wakeEvent, 1) < 0 ? -1 : 0;
+#else
+    char byte = 0;
+
+    /* a full pipe already wakes the poller */
+    if (write (poller -> wakePipe [1], & byte, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+
+    return 0;
+#endif
+}
+
 #endif
 
@@ -402,6 +402,55 @@ enet_socket_receive (ENetSocket socket,
     return (int) recvLength;
 }
 
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t bufferCount)
+{
+    size_t i;
+
+    /* no recvmmsg equivalent, receive one datagram per call */
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        int recvLength = enet_socket_receive (socket, & addresses [i], & buffers [i], 1);
+
+        if (recvLength == -2)
+        {
+            buffers [i].dataLength = 0;
+            continue;
+        }
+
+        if (recvLength < 0)
+          return i > 0 ? (int) i : -1;
+
+        if (recvLength == 0)
+          break;
+
+        buffers [i].dataLength = recvLength;
+    }
+
+    return (int) i;
+}
+
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t bufferCount,
+                        enet_uint32 * flags)
+{
+    size_t i;
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        if (enet_socket_send (socket, & addresses [i], & buffers [i], 1) < 0)
+          return -1;
+    }
+
+    return (int) bufferCount;
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
@@ -451,5 +500,131 @@ enet_socket_wait (ENetSocket socket, enet_uint32 * condition, enet_uint32 timeou
     return 0;
 } 
 
+#define ENET_SOCKET_POLLER_MAXIMUM 63
+
+struct _ENetSocketPoller
+{
+    ENetSocket sockets [ENET_SOCKET_POLLER_MAXIMUM];
+    size_t socketCount;
+    ENetSocket wakeSocket; /* loopback datagram socket, woken up by sending a datagram to itself */
+    ENetAddress wakeAddress;
+};
+
+ENetSocketPoller *
+enet_socket_poller_create (void)
+{
+    ENetSocketPoller * poller = (ENetSocketPoller *) enet_malloc (sizeof (ENetSocketPoller));
+    ENetAddress address;
+
+    if (poller == NULL)
+      return NULL;
+
+    poller -> socketCount = 0;
+    poller -> wakeSocket = enet_socket_create (ENET_SOCKET_TYPE_DATAGRAM);
+
+    address.host = ENET_HOST_TO_NET_32 (0x7F000001);
+    address.port = 0;
+
+    if (poller -> wakeSocket == ENET_SOCKET_NULL ||
+        enet_socket_bind (poller -> wakeSocket, & address) < 0 ||
+        enet_socket_get_address (poller -> wakeSocket, & poller -> wakeAddress) < 0 ||
+        enet_socket_set_option (poller -> wakeSocket, ENET_SOCKOPT_NONBLOCK, 1) < 0)
+    {
+       if (poller -> wakeSocket != ENET_SOCKET_NULL)
+         enet_socket_destroy (poller -> wakeSocket);
+
+       enet_free (poller);
+
+       return NULL;
+    }
+
+    return poller;
+}
+
+void
+enet_socket_poller_destroy (ENetSocketPoller * poller)
+{
+    enet_socket_destroy (poller -> wakeSocket);
+
+    enet_free (poller);
+}
+
+int
+enet_socket_poller_add (ENetSocketPoller * poller, ENetSocket socket)
+{
+    if (poller -> socketCount >= ENET_SOCKET_POLLER_MAXIMUM)
+      return -1;
+
+    poller -> sockets [poller -> socketCount ++] = socket;
+
+    return 0;
+}
+
+int
+enet_socket_poller_remove (ENetSocketPoller * poller, ENetSocket socket)
+{
+    size_t i;
+
+    for (i = 0; i < poller -> socketCount; ++ i)
+    {
+       if (poller -> sockets [i] != socket)
+         continue;
+
+       poller -> sockets [i] = poller -> sockets [-- poller -> socketCount];
+
+       return 0;
+    }
+
+    return -1;
+}
+
+int
+enet_socket_poller_wait (ENetSocketPoller * poller, enet_uint32 timeout)
+{
+    fd_set readSet;
+    struct timeval timeVal;
+    int selectCount;
+    size_t i;
+
+    timeVal.tv_sec = timeout / 1000;
+    timeVal.tv_usec = (timeout % 1000) * 1000;
+
+    FD_ZERO (& readSet);
+    FD_SET (poller -> wakeSocket, & readSet);
+
+    for (i = 0; i < poller -> socketCount; ++ i)
+      FD_SET (poller -> sockets [i], & readSet);
+
+    selectCount = select (0, & readSet, NULL, NULL, & timeVal);
+    if (selectCount < 0)
+      return -1;
+
+    if (selectCount > 0 && FD_ISSET (poller -> wakeSocket, & readSet))
+    {
+       enet_uint8 drain [16];
+       ENetBuffer buffer;
+
+       buffer.data = drain;
+       buffer.dataLength = sizeof (drain);
+
+       while (enet_socket_receive (poller -> wakeSocket, NULL, & buffer, 1) > 0)
+         ;
+    }
+
+    return selectCount;
+}
+
+int
+enet_socket_poller_wake (ENetSocketPoller * poller)
+{
+    enet_uint8 byte = 0;
+    ENetBuffer buffer;
+
+    buffer.data = & byte;
+    buffer.dataLength = 1;
+
+    return enet_socket_send (poller -> wakeSocket, & poller -> wakeAddress, & buffer, 1) < 0 ? -1 : 0;
+}
+
 #endif
 
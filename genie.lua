@@ -10,4 +10,123 @@ if plugin "net" then
 	includedirs { "src", "external/enet/include", "../../external/luau/include" }
 	defines { "BUILDING_NET", "_WINSOCK_DEPRECATED_NO_WARNINGS" }
 	dynamic_link_plugin { "engine" }
-end
\ No newline at end of file
+end
+
+newoption {
+	trigger = "net-bench",
+	description = "Build benchmarks of the network plugin."
+}
+
+if _OPTIONS["net-bench"] then
+	project "net_bench_replication"
+		kind "ConsoleApp"
+		files {
+			"bench/replication_bench.cpp",
+			"src/replication.cpp",
+			"src/replication.h",
+			"src/varint.h"
+		}
+		includedirs { "src", "../../src" }
+		links { "core" }
+		defaultConfigurations()
+
+	project "net_bench_compression"
+		kind "ConsoleApp"
+		files {
+			"bench/compression_bench.cpp",
+			"external/enet/*.c",
+			"src/lz_compressor.cpp",
+			"src/lz_compressor.h",
+			"src/replication.cpp",
+			"src/replication.h",
+			"src/varint.h"
+		}
+		includedirs { "src", "external/enet/include", "../../src" }
+		links { "core" }
+		configuration { "windows" }
+			links { "ws2_32", "winmm" }
+		configuration {}
+		defaultConfigurations()
+
+	project "net_bench_checksum"
+		kind "ConsoleApp"
+		files {
+			"bench/checksum_bench.cpp",
+			"external/enet/*.c",
+			"src/crc32c.cpp",
+			"src/crc32c.h"
+		}
+		includedirs { "src", "external/enet/include", "../../src" }
+		links { "core" }
+		configuration { "windows" }
+			links { "ws2_32", "winmm" }
+		configuration {}
+		defaultConfigurations()
+
+	project "net_bench_loopback"
+		kind "ConsoleApp"
+		files {
+			"bench/loopback_bench.cpp",
+			"external/enet/*.c",
+			"src/rpc.h",
+			"src/varint.h"
+		}
+		includedirs { "src", "external/enet/include", "../../src" }
+		links { "core" }
+		configuration { "windows" }
+			links { "ws2_32", "winmm" }
+		configuration {}
+		defaultConfigurations()
+end
+
+newoption {
+	trigger = "net-test",
+	description = "Build tests of the network plugin."
+}
+
+if _OPTIONS["net-test"] then
+	project "net_test_bit_stream"
+		kind "ConsoleApp"
+		files {
+			"test/bit_stream_test.cpp",
+			"src/bit_stream.cpp",
+			"src/bit_stream.h"
+		}
+		includedirs { "src", "../../src" }
+		links { "core" }
+		defaultConfigurations()
+
+	project "net_test_rpc"
+		kind "ConsoleApp"
+		files {
+			"test/rpc_test.cpp",
+			"src/rpc.cpp",
+			"src/rpc.h",
+			"src/varint.h"
+		}
+		includedirs { "src", "../../src", "../../external/luau/include" }
+		links { "core", "luau" }
+		defaultConfigurations()
+
+	-- net.cpp is included by the test
+	project "net_test_hosts"
+		kind "ConsoleApp"
+		files {
+			"test/hosts_test.cpp",
+			"external/enet/*.c",
+			"src/**.h",
+			"src/bit_stream.cpp",
+			"src/crc32c.cpp",
+			"src/interest.cpp",
+			"src/lz_compressor.cpp",
+			"src/packet_pool.cpp",
+			"src/replication.cpp",
+			"src/rpc.cpp"
+		}
+		includedirs { "src", "external/enet/include", "../../src", "../../external/luau/include" }
+		links { "core", "engine", "luau" }
+		configuration { "windows" }
+			links { "ws2_32", "winmm" }
+		configuration {}
+		defaultConfigurations()
+end
@@ -0,0 +1,299 @@
+#include "bit_stream.h"
+#include "core/math.h"
+#include "core/stream.h"
+#include <math.h>
+#include <string.h>
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+namespace Lumix {
+
+static constexpr float QUAT_COMPONENT_MAX = 0.70710678f; // 1 / sqrt(2)
+static constexpr u32 FLOAT_BATCH_SIZE = 64;
+
+u32 bitsRequired(u32 max) {
+	#ifdef _MSC_VER
+		unsigned long idx;
+		return _BitScanReverse(&idx, max) ? idx + 1 : 0;
+	#else
+		return max ? 32 - __builtin_clz(max) : 0;
+	#endif
+}
+
+// maps [min, max] to integers [0, max_value]
+struct Quantization {
+	Quantization(float min, float max, float precision) : min(min), max(max) {
+		ASSERT(max > min && precision > 0);
+		const double steps = ceil((double(max) - min) / precision);
+		init(steps < 4294967295.0 ? (u32)steps : 0xffFFffFF);
+	}
+
+	static Quantization fromBits(float min, float max, u32 bits) {
+		Quantization res;
+		res.min = min;
+		res.max = max;
+		res.init(u32((u64(1) << bits) - 1));
+		return res;
+	}
+
+	// NaN ends up as min; in double, rounding in float can give max_value + 1 for big ranges
+	u32 quantize(float value) const {
+		value = value > min ? value : min;
+		value = value < max ? value : max;
+		const double q = (double(value) - min) * scale + 0.5;
+		return q < max_value ? (u32)q : max_value;
+	}
+
+	// `value` <= max_value
+	float dequantize(u32 value) const {
+		const float res = float(min + value * inv_scale);
+		return res < max ? res : max;
+	}
+
+	float min;
+	float max;
+	double scale;
+	double inv_scale;
+	u32 max_value;
+	u32 bits;
+
+private:
+	Quantization() = default;
+
+	void init(u32 steps) {
+		max_value = steps;
+		bits = bitsRequired(max_value);
+		scale = max_value / (double(max) - min);
+		inv_scale = (double(max) - min) / max_value;
+	}
+};
+
+BitWriter::BitWriter(OutputMemoryStream& blob)
+	: m_blob(blob)
+{}
+
+BitWriter::~BitWriter() {
+	flush();
+}
+
+void BitWriter::write(u32 value, u32 bits) {
+	ASSERT(bits <= 32);
+	ASSERT(bits == 32 || value < (1u << bits));
+	m_scratch |= u64(value) << m_scratch_bits;
+	m_scratch_bits += bits;
+	m_bits_count += bits;
+	if (m_scratch_bits >= 32) {
+		m_blob.write(u32(m_scratch));
+		m_scratch >>= 32;
+		m_scratch_bits -= 32;
+	}
+}
+
+void BitWriter::flush() {
+	const u32 bytes = (m_scratch_bits + 7) >> 3;
+	if (bytes == 0) return;
+	const u32 tmp = u32(m_scratch);
+	m_blob.write(&tmp, bytes);
+	m_bits_count += bytes * 8 - m_scratch_bits;
+	m_scratch = 0;
+	m_scratch_bits = 0;
+}
+
+void BitWriter::writeBool(bool value) {
+	write(value ? 1 : 0, 1);
+}
+
+void BitWriter::writeInt(i32 value, i32 min, i32 max) {
+	ASSERT(min <= max && value >= min && value <= max);
+	const u32 range = u32(i64(max) - min);
+	write(u32(i64(value) - min), bitsRequired(range));
+}
+
+void BitWriter::writeVarint(u32 value, u32 max) {
+	ASSERT(value <= max);
+	const u32 length = bitsRequired(value);
+	write(length, bitsRequired(bitsRequired(max)));
+	// the highest bit is implied by the length
+	if (length > 1) write(value & ~(1u << (length - 1)), length - 1);
+}
+
+void BitWriter::writeRawFloat(float value) {
+	u32 tmp;
+	memcpy(&tmp, &value, sizeof(tmp));
+	write(tmp, 32);
+}
+
+void BitWriter::writeFloat(float value, float min, float max, float precision) {
+	const Quantization q(min, max, precision);
+	write(q.quantize(value), q.bits);
+}
+
+void BitWriter::writeFloats(Span<const float> values, float min, float max, float precision) {
+	const Quantization q(min, max, precision);
+	// quantize a batch first, without branches it vectorizes
+	u32 quantized[FLOAT_BATCH_SIZE];
+	for (u32 from = 0; from < values.length(); from += FLOAT_BATCH_SIZE) {
+		const u32 count = minimum(FLOAT_BATCH_SIZE, values.length() - from);
+		const float* src = values.begin() + from;
+		for (u32 i = 0; i < count; ++i) quantized[i] = q.quantize(src[i]);
+		for (u32 i = 0; i < count; ++i) write(quantized[i], q.bits);
+	}
+}
+
+void BitWriter::writeVec3(const Vec3& value, float min, float max, float precision) {
+	const Quantization q(min, max, precision);
+	write(q.quantize(value.x), q.bits);
+	write(q.quantize(value.y), q.bits);
+	write(q.quantize(value.z), q.bits);
+}
+
+void BitWriter::writeQuat(const Quat& value, u32 bits) {
+	ASSERT(bits >= 2 && bits <= 31);
+	const float c[4] = {value.x, value.y, value.z, value.w};
+	u32 largest = 0;
+	for (u32 i = 1; i < 4; ++i) {
+		if (fabsf(c[i]) > fabsf(c[largest])) largest = i;
+	}
+	// q and -q are the same rotation, flip so the omitted component is positive
+	const float sign = c[largest] < 0 ? -1.f : 1.f;
+
+	const Quantization q = Quantization::fromBits(-QUAT_COMPONENT_MAX, QUAT_COMPONENT_MAX, bits);
+	write(largest, 2);
+	for (u32 i = 0; i < 4; ++i) {
+		if (i != largest) write(q.quantize(c[i] * sign), bits);
+	}
+}
+
+BitReader::BitReader(const void* data, u32 size)
+	: m_data((const u8*)data)
+	, m_size(size)
+{}
+
+void BitReader::refill() {
+	if (m_size - m_pos >= 4) {
+		u32 word;
+		memcpy(&word, m_data + m_pos, sizeof(word));
+		m_scratch |= u64(word) << m_scratch_bits;
+		m_scratch_bits += 32;
+		m_pos += 4;
+		return;
+	}
+	while (m_pos < m_size && m_scratch_bits <= 56) {
+		m_scratch |= u64(m_data[m_pos]) << m_scratch_bits;
+		m_scratch_bits += 8;
+		++m_pos;
+	}
+}
+
+u32 BitReader::read(u32 bits) {
+	ASSERT(bits <= 32);
+	if (m_scratch_bits < bits) {
+		refill();
+		if (m_scratch_bits < bits) {
+			m_is_valid = false;
+			m_scratch = 0;
+			m_scratch_bits = 0;
+			return 0;
+		}
+	}
+	const u32 res = u32(m_scratch & ((u64(1) << bits) - 1));
+	m_scratch >>= bits;
+	m_scratch_bits -= bits;
+	return res;
+}
+
+bool BitReader::readBool() {
+	return read(1) != 0;
+}
+
+i32 BitReader::readInt(i32 min, i32 max) {
+	const u32 range = u32(i64(max) - min);
+	const u32 value = read(bitsRequired(range));
+	if (value > range) {
+		m_is_valid = false;
+		return min;
+	}
+	return i32(i64(min) + value);
+}
+
+u32 BitReader::readVarint(u32 max) {
+	const u32 length = read(bitsRequired(bitsRequired(max)));
+	if (length == 0) return 0;
+	if (length > 32) {
+		m_is_valid = false;
+		return 0;
+	}
+	const u32 value = (1u << (length - 1)) | read(length - 1);
+	if (value > max) {
+		m_is_valid = false;
+		return 0;
+	}
+	return value;
+}
+
+float BitReader::readRawFloat() {
+	const u32 tmp = read(32);
+	float res;
+	memcpy(&res, &tmp, sizeof(res));
+	return res;
+}
+
+void BitReader::align() {
+	// the scratch is refilled by whole bytes, so the bits of the current byte are the odd ones
+	const u32 bits = m_scratch_bits & 7;
+	m_scratch >>= bits;
+	m_scratch_bits -= bits;
+}
+
+float BitReader::readQuantized(const Quantization& q) {
+	const u32 value = read(q.bits);
+	if (!m_is_valid) return 0;
+	if (value > q.max_value) {
+		m_is_valid = false;
+		return 0;
+	}
+	return q.dequantize(value);
+}
+
+float BitReader::readFloat(float min, float max, float precision) {
+	const Quantization q(min, max, precision);
+	return readQuantized(q);
+}
+
+void BitReader::readFloats(Span<float> values, float min, float max, float precision) {
+	const Quantization q(min, max, precision);
+	for (float& v : values) v = readQuantized(q);
+}
+
+Vec3 BitReader::readVec3(float min, float max, float precision) {
+	const Quantization q(min, max, precision);
+	Vec3 res;
+	res.x = readQuantized(q);
+	res.y = readQuantized(q);
+	res.z = readQuantized(q);
+	return res;
+}
+
+Quat BitReader::readQuat(u32 bits) {
+	ASSERT(bits >= 2 && bits <= 31);
+	const Quantization q = Quantization::fromBits(-QUAT_COMPONENT_MAX, QUAT_COMPONENT_MAX, bits);
+	const u32 largest = read(2);
+	float c[4];
+	float sum = 0;
+	for (u32 i = 0; i < 4; ++i) {
+		if (i == largest) continue;
+		c[i] = readQuantized(q);
+		sum += c[i] * c[i];
+	}
+	// malformed input returns zeros like other values
+	c[largest] = m_is_valid ? sqrtf(maximum(0.f, 1 - sum)) : 0;
+	Quat res;
+	res.x = c[0];
+	res.y = c[1];
+	res.z = c[2];
+	res.w = c[3];
+	return res;
+}
+
+} // namespace Lumix
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "core/core.h"
+
+namespace Lumix {
+
+struct OutputMemoryStream;
+struct Quat;
+struct Quantization;
+struct Vec3;
+
+// Bit granular serialization, values take only as many bits as their range needs. Bits are gathered
+// in a 64bit scratch word and moved to / from memory 32 bits at a time, in little endian order.
+// Both sides must use the same ranges and precisions.
+struct BitWriter {
+	explicit BitWriter(OutputMemoryStream& blob);
+	~BitWriter();
+
+	// `bits` <= 32, `value` must fit
+	void write(u32 value, u32 bits);
+	void writeBool(bool value);
+	// `value` in [min, max]
+	void writeInt(i32 value, i32 min, i32 max);
+	// small values take fewer bits, the bit length of `value` (bitsRequired(bitsRequired(max)) bits)
+	// and its bits below the highest set one, `value` <= max
+	void writeVarint(u32 value, u32 max);
+	void writeRawFloat(float value);
+	// clamped to [min, max] and quantized with at least `precision`
+	void writeFloat(float value, float min, float max, float precision);
+	void writeFloats(Span<const float> values, float min, float max, float precision);
+	void writeVec3(const Vec3& value, float min, float max, float precision);
+	// smallest three, index of the largest component and three other components with `bits` bits each
+	void writeQuat(const Quat& value, u32 bits);
+
+	// writes pending bits padded to a whole byte, the destructor flushes too; if more values follow,
+	// the reader must call BitReader::align at the same place
+	void flush();
+	u64 getBitsCount() const { return m_bits_count; }
+
+private:
+	OutputMemoryStream& m_blob;
+	u64 m_scratch = 0;
+	u32 m_scratch_bits = 0;
+	u64 m_bits_count = 0;
+};
+
+// Reading past the end or malformed values return zeros and make the reader invalid.
+struct BitReader {
+	BitReader(const void* data, u32 size);
+
+	u32 read(u32 bits);
+	bool readBool();
+	i32 readInt(i32 min, i32 max);
+	u32 readVarint(u32 max);
+	float readRawFloat();
+	float readFloat(float min, float max, float precision);
+	void readFloats(Span<float> values, float min, float max, float precision);
+	Vec3 readVec3(float min, float max, float precision);
+	Quat readQuat(u32 bits);
+	// skips to the next whole byte, matches BitWriter::flush in the middle of a stream
+	void align();
+
+	bool isValid() const { return m_is_valid; }
+
+private:
+	void refill();
+	float readQuantized(const Quantization& q);
+
+	const u8* m_data;
+	u32 m_size;
+	u32 m_pos = 0;
+	u64 m_scratch = 0;
+	u32 m_scratch_bits = 0;
+	bool m_is_valid = true;
+};
+
+// number of bits needed to represent values in [0, max]
+u32 bitsRequired(u32 max);
+
+} // namespace Lumix
@@ -0,0 +1,133 @@
+#include "crc32c.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+	#define CRC32C_X86
+	#include <nmmintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define CRC32C_TARGET
+	#else
+		#include <cpuid.h>
+		// the rest of the file does not need SSE4.2
+		#define CRC32C_TARGET __attribute__((target("sse4.2")))
+	#endif
+#elif defined(__ARM_FEATURE_CRC32)
+	#define CRC32C_ARM
+	#include <arm_acle.h>
+#endif
+
+namespace Lumix {
+
+namespace {
+
+// reflected 0x1EDC6F41
+constexpr u32 POLYNOMIAL = 0x82F63B78;
+
+// t[0] is the classic byte table, t[k][i] is the crc of byte i followed by k zero bytes
+struct Tables {
+	constexpr Tables() {
+		for (u32 i = 0; i < 256; ++i) {
+			u32 crc = i;
+			for (u32 j = 0; j < 8; ++j) crc = (crc >> 1) ^ (POLYNOMIAL & (0 - (crc & 1)));
+			t[0][i] = crc;
+		}
+		for (u32 k = 1; k < 8; ++k) {
+			for (u32 i = 0; i < 256; ++i) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+		}
+	}
+
+	u32 t[8][256] = {};
+};
+
+constexpr Tables TABLES;
+
+#if defined(CRC32C_X86)
+	bool hasCRC32Instruction() {
+		#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 20)) != 0;
+		#else
+			unsigned int eax, ebx, ecx, edx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+			return (ecx & bit_SSE4_2) != 0;
+		#endif
+	}
+
+	// datagrams are too short for interleaved streams combined with PCLMUL to pay off,
+	// the dependency chain of one crc32 per 8 bytes is fast enough
+	CRC32C_TARGET u32 crc32cHardware(const u8* data, u64 size, u32 crc) {
+		for (; size > 0 && (uintptr(data) & 7) != 0; --size, ++data) crc = _mm_crc32_u8(crc, *data);
+		#if defined(_M_X64) || defined(__x86_64__)
+			u64 crc64 = crc;
+			for (; size >= 8; size -= 8, data += 8) {
+				u64 word;
+				memcpy(&word, data, sizeof(word));
+				crc64 = _mm_crc32_u64(crc64, word);
+			}
+			crc = (u32)crc64;
+		#else
+			for (; size >= 4; size -= 4, data += 4) {
+				u32 word;
+				memcpy(&word, data, sizeof(word));
+				crc = _mm_crc32_u32(crc, word);
+			}
+		#endif
+		for (; size > 0; --size, ++data) crc = _mm_crc32_u8(crc, *data);
+		return crc;
+	}
+#elif defined(CRC32C_ARM)
+	bool hasCRC32Instruction() { return true; }
+
+	u32 crc32cHardware(const u8* data, u64 size, u32 crc) {
+		for (; size > 0 && (uintptr(data) & 7) != 0; --size, ++data) crc = __crc32cb(crc, *data);
+		for (; size >= 8; size -= 8, data += 8) {
+			u64 word;
+			memcpy(&word, data, sizeof(word));
+			crc = __crc32cd(crc, word);
+		}
+		for (; size > 0; --size, ++data) crc = __crc32cb(crc, *data);
+		return crc;
+	}
+#else
+	bool hasCRC32Instruction() { return false; }
+	u32 crc32cHardware(const u8*, u64, u32 crc) { return crc; }
+#endif
+
+const bool g_has_crc32_instruction = hasCRC32Instruction();
+
+} // anonymous namespace
+
+u32 crc32cSoftware(const void* data, u64 size, u32 crc) {
+	const u8* p = (const u8*)data;
+	crc = ~crc;
+	for (; size > 0 && (uintptr(p) & 7) != 0; --size, ++p) crc = TABLES.t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+	// 8 independent lookups per word instead of a chain of 8, assumes little endian
+	for (; size >= 8; size -= 8, p += 8) {
+		u64 word;
+		memcpy(&word, p, sizeof(word));
+		word ^= crc;
+		crc = TABLES.t[7][word & 0xff]
+			^ TABLES.t[6][(word >> 8) & 0xff]
+			^ TABLES.t[5][(word >> 16) & 0xff]
+			^ TABLES.t[4][(word >> 24) & 0xff]
+			^ TABLES.t[3][(word >> 32) & 0xff]
+			^ TABLES.t[2][(word >> 40) & 0xff]
+			^ TABLES.t[1][(word >> 48) & 0xff]
+			^ TABLES.t[0][word >> 56];
+	}
+	for (; size > 0; --size, ++p) crc = TABLES.t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+u32 crc32c(const void* data, u64 size, u32 crc) {
+	if (g_has_crc32_instruction) return ~crc32cHardware((const u8*)data, size, ~crc);
+	return crc32cSoftware(data, size, crc);
+}
+
+bool isCRC32CAccelerated() {
+	return g_has_crc32_instruction;
+}
+
+} // namespace Lumix
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "core/core.h"
+
+namespace Lumix {
+
+// CRC32C (Castagnoli polynomial), detects more error patterns than ENet's CRC32 and x86 (SSE4.2) and ARMv8 have
+// an instruction for it. `crc` is a checksum of preceding data, so checksums of buffers can be chained.
+// Uses the crc32 instruction if the CPU supports it, slice-by-8 tables otherwise.
+u32 crc32c(const void* data, u64 size, u32 crc = 0);
+// portable slice-by-8 implementation, same results as `crc32c`
+u32 crc32cSoftware(const void* data, u64 size, u32 crc = 0);
+bool isCRC32CAccelerated();
+
+} // namespace Lumix
@@ -0,0 +1,296 @@
+#include "engine/world.h"
+#include "interest.h"
+#include <math.h>
+#include <stdlib.h>
+
+namespace Lumix {
+
+Interest::Interest(IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_cells(allocator)
+	, m_cell_map(allocator)
+	, m_entities(allocator)
+	, m_entity_map(allocator)
+	, m_moved_entities(allocator)
+	, m_global_entities(allocator)
+	, m_viewers(allocator)
+	, m_viewer_map(allocator)
+	, m_changed(allocator)
+{}
+
+Interest::~Interest() {
+	bindWorld(nullptr);
+}
+
+void Interest::setCellSize(float size) {
+	ASSERT(m_entities.empty());
+	ASSERT(size > 0);
+	m_cell_size = size;
+}
+
+void Interest::bindWorld(World* world) {
+	if (m_world) m_world->entityTransformed().unbind<&Interest::onEntityTransformed>(this);
+	m_world = world;
+	if (m_world) m_world->entityTransformed().bind<&Interest::onEntityTransformed>(this);
+}
+
+void Interest::onEntityTransformed(EntityRef entity) {
+	if (isTracked(entity)) setPosition(entity, m_world->getPosition(entity));
+}
+
+Interest::CellCoord Interest::getCell(const DVec3& pos) const {
+	CellCoord res;
+	res.x = (i32)floor(pos.x / m_cell_size);
+	res.z = (i32)floor(pos.z / m_cell_size);
+	return res;
+}
+
+Interest::Cell* Interest::findCell(const CellCoord& c) const {
+	auto iter = m_cell_map.find(getCellKey(c));
+	return iter.isValid() ? &m_cells[iter.value()] : nullptr;
+}
+
+Interest::Cell& Interest::getOrCreateCell(const CellCoord& c) {
+	if (Cell* cell = findCell(c)) return *cell;
+
+	m_cell_map.insert(getCellKey(c), m_cells.size());
+	Cell& cell = m_cells.emplace(m_allocator);
+	cell.coord = c;
+	return cell;
+}
+
+void Interest::removeFromCell(EntityRef entity, const CellCoord& c) {
+	Cell* cell = findCell(c);
+	ASSERT(cell);
+	const i32 idx = cell->entities.indexOf(entity);
+	ASSERT(idx >= 0);
+	cell->entities.swapAndPop(idx);
+}
+
+// empty cells are never freed, so big ranges are cheaper to check against existing cells
+template <typename F>
+void Interest::forEachCell(const CellRange& range, F&& f) const {
+	const u64 area = u64(range.to.x - range.from.x + 1) * u64(range.to.z - range.from.z + 1);
+	if (area > (u64)m_cells.size()) {
+		for (const Cell& cell : m_cells) {
+			if (range.contains(cell.coord)) f(cell);
+		}
+		return;
+	}
+
+	for (i32 z = range.from.z; z <= range.to.z; ++z) {
+		for (i32 x = range.from.x; x <= range.to.x; ++x) {
+			if (const Cell* cell = findCell({x, z})) f(*cell);
+		}
+	}
+}
+
+void Interest::addEntity(EntityRef entity, const DVec3& pos) {
+	if (isTracked(entity)) {
+		setPosition(entity, pos);
+		return;
+	}
+
+	TrackedEntity& e = m_entities.emplace();
+	e.entity = entity;
+	e.cell = getCell(pos);
+	e.is_moved = true;
+	m_entity_map.insert(entity.index, m_entities.size() - 1);
+	getOrCreateCell(e.cell).entities.push(entity);
+	m_moved_entities.push(entity);
+}
+
+void Interest::removeEntity(EntityRef entity) {
+	auto iter = m_entity_map.find(entity.index);
+	if (!iter.isValid()) return;
+
+	const u32 idx = iter.value();
+	const TrackedEntity& e = m_entities[idx];
+	if (e.is_reported) {
+		for (const Viewer& viewer : m_viewers) {
+			if (viewer.is_reported && viewer.reported_range.contains(e.reported_cell)) notify(viewer.connection, entity, false);
+		}
+	}
+	removeFromCell(entity, e.cell);
+
+	m_entity_map.erase(entity.index);
+	if (idx != m_entities.size() - 1) {
+		m_entities[idx] = m_entities.last();
+		m_entity_map.find(m_entities[idx].entity.index).value() = idx;
+	}
+	m_entities.pop();
+}
+
+void Interest::setPosition(EntityRef entity, const DVec3& pos) {
+	auto iter = m_entity_map.find(entity.index);
+	if (!iter.isValid()) return;
+
+	TrackedEntity& e = m_entities[iter.value()];
+	const CellCoord cell = getCell(pos);
+	if (cell.x == e.cell.x && cell.z == e.cell.z) return;
+
+	removeFromCell(entity, e.cell);
+	e.cell = cell;
+	getOrCreateCell(cell).entities.push(entity);
+	if (!e.is_moved) {
+		e.is_moved = true;
+		m_moved_entities.push(entity);
+	}
+}
+
+bool Interest::isTracked(EntityRef entity) const {
+	return m_entity_map.find(entity.index).isValid();
+}
+
+static u32 lowerBound(const Array<EntityRef>& entities, EntityRef entity) {
+	u32 lo = 0;
+	u32 hi = entities.size();
+	while (lo < hi) {
+		const u32 mid = (lo + hi) >> 1;
+		if (entities[mid].index < entity.index) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+void Interest::addGlobalEntity(EntityRef entity) {
+	const u32 idx = lowerBound(m_global_entities, entity);
+	if (idx < (u32)m_global_entities.size() && m_global_entities[idx] == entity) return;
+	m_global_entities.insert(idx, entity);
+}
+
+void Interest::removeGlobalEntity(EntityRef entity) {
+	const u32 idx = lowerBound(m_global_entities, entity);
+	if (idx < (u32)m_global_entities.size() && m_global_entities[idx] == entity) m_global_entities.erase(idx);
+}
+
+void Interest::setViewer(ConnectionHandle connection, const DVec3& pos, float radius) {
+	auto iter = m_viewer_map.find(connection);
+	Viewer* viewer;
+	if (iter.isValid()) {
+		viewer = &m_viewers[iter.value()];
+	}
+	else {
+		m_viewer_map.insert(connection, m_viewers.size());
+		viewer = &m_viewers.emplace();
+		viewer->connection = connection;
+	}
+
+	CellRange range;
+	range.from = getCell({pos.x - radius, pos.y, pos.z - radius});
+	range.to = getCell({pos.x + radius, pos.y, pos.z + radius});
+	viewer->range = range;
+	viewer->is_moved = true;
+}
+
+void Interest::removeViewer(ConnectionHandle connection) {
+	auto iter = m_viewer_map.find(connection);
+	if (!iter.isValid()) return;
+
+	const u32 idx = iter.value();
+	m_viewer_map.erase(connection);
+	if (idx != m_viewers.size() - 1) {
+		m_viewers[idx] = m_viewers.last();
+		m_viewer_map.find(m_viewers[idx].connection).value() = idx;
+	}
+	m_viewers.pop();
+}
+
+bool Interest::hasViewer(ConnectionHandle connection) const {
+	return m_viewer_map.find(connection).isValid();
+}
+
+bool Interest::isRelevant(ConnectionHandle connection, EntityRef entity) const {
+	auto viewer_iter = m_viewer_map.find(connection);
+	if (!viewer_iter.isValid()) return true;
+
+	auto entity_iter = m_entity_map.find(entity.index);
+	if (!entity_iter.isValid()) {
+		const u32 idx = lowerBound(m_global_entities, entity);
+		return idx < (u32)m_global_entities.size() && m_global_entities[idx] == entity;
+	}
+
+	return isReported(m_viewers[viewer_iter.value()], m_entities[entity_iter.value()]);
+}
+
+static int compareEntities(const void* a, const void* b) {
+	return ((const EntityRef*)a)->index - ((const EntityRef*)b)->index;
+}
+
+bool Interest::getRelevantEntities(ConnectionHandle connection, Array<EntityRef>& entities) const {
+	entities.clear();
+	auto iter = m_viewer_map.find(connection);
+	if (!iter.isValid()) return false;
+
+	// cells hold current positions, entities are filtered by reported cells to match isRelevant
+	const Viewer& viewer = m_viewers[iter.value()];
+	if (viewer.is_reported) {
+		forEachCell(viewer.reported_range, [&](const Cell& cell){
+			for (EntityRef e : cell.entities) {
+				if (isReported(viewer, m_entities[m_entity_map.find(e.index).value()])) entities.push(e);
+			}
+		});
+		// moved out of the range since the last update, so not in the cells above
+		for (EntityRef e : m_moved_entities) {
+			auto entity_iter = m_entity_map.find(e.index);
+			if (!entity_iter.isValid()) continue;
+			const TrackedEntity& tracked = m_entities[entity_iter.value()];
+			if (!viewer.reported_range.contains(tracked.cell) && isReported(viewer, tracked)) entities.push(e);
+		}
+	}
+	for (EntityRef e : m_global_entities) entities.push(e);
+	if (!entities.empty()) qsort(entities.begin(), entities.size(), sizeof(EntityRef), &compareEntities);
+	return true;
+}
+
+bool Interest::isReported(const Viewer& viewer, const TrackedEntity& entity) {
+	return viewer.is_reported && entity.is_reported && viewer.reported_range.contains(entity.reported_cell);
+}
+
+void Interest::notify(ConnectionHandle connection, EntityRef entity, bool entered) {
+	m_changed.invoke(connection, entity, entered);
+}
+
+void Interest::updateViewer(Viewer& viewer) {
+	viewer.is_moved = false;
+	const CellRange& prev = viewer.reported_range;
+	const CellRange& next = viewer.range;
+	if (viewer.is_reported) {
+		forEachCell(prev, [&](const Cell& cell){
+			if (next.contains(cell.coord)) return;
+			for (EntityRef e : cell.entities) notify(viewer.connection, e, false);
+		});
+	}
+	forEachCell(next, [&](const Cell& cell){
+		if (viewer.is_reported && prev.contains(cell.coord)) return;
+		for (EntityRef e : cell.entities) notify(viewer.connection, e, true);
+	});
+	viewer.reported_range = next;
+	viewer.is_reported = true;
+}
+
+void Interest::update() {
+	// entities first, against ranges viewers were told about, so moved viewers see entities in their new cells
+	for (EntityRef entity : m_moved_entities) {
+		auto iter = m_entity_map.find(entity.index);
+		if (!iter.isValid()) continue;
+
+		TrackedEntity& e = m_entities[iter.value()];
+		e.is_moved = false;
+		for (const Viewer& viewer : m_viewers) {
+			if (!viewer.is_reported) continue;
+			const bool was_relevant = e.is_reported && viewer.reported_range.contains(e.reported_cell);
+			const bool is_relevant = viewer.reported_range.contains(e.cell);
+			if (was_relevant != is_relevant) notify(viewer.connection, entity, is_relevant);
+		}
+		e.reported_cell = e.cell;
+		e.is_reported = true;
+	}
+	m_moved_entities.clear();
+
+	for (Viewer& viewer : m_viewers) {
+		if (viewer.is_moved) updateViewer(viewer);
+	}
+}
+
+} // namespace Lumix
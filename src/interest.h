@@ -0,0 +1,116 @@
+#pragma once
+
+#include "core/array.h"
+#include "core/delegate_list.h"
+#include "core/hash_map.h"
+#include "core/math.h"
+#include "net.h"
+
+namespace Lumix {
+
+struct World;
+
+// Interest management, decides which entities are relevant to which connection. Entities are kept in
+// a uniform grid on the XZ plane, every connection with a viewer is interested in entities in cells
+// overlapping its view radius. Connections without a viewer are interested in everything.
+// Enter / leave events are computed incrementally in `update` from entities and viewers which changed cells.
+struct Interest {
+	using ConnectionHandle = NetSystem::ConnectionHandle;
+
+	Interest(IAllocator& allocator);
+	~Interest();
+
+	// only while there are no entities
+	void setCellSize(float size);
+	float getCellSize() const { return m_cell_size; }
+	// tracked entities follow their transforms in the world, pass nullptr before the world is destroyed
+	void bindWorld(World* world);
+
+	void addEntity(EntityRef entity, const DVec3& pos);
+	// leave events are sent right away
+	void removeEntity(EntityRef entity);
+	void setPosition(EntityRef entity, const DVec3& pos);
+	bool isTracked(EntityRef entity) const;
+	// global entities are relevant to every connection, they have no enter / leave events
+	void addGlobalEntity(EntityRef entity);
+	void removeGlobalEntity(EntityRef entity);
+
+	void setViewer(ConnectionHandle connection, const DVec3& pos, float radius);
+	void removeViewer(ConnectionHandle connection);
+	bool hasViewer(ConnectionHandle connection) const;
+
+	// as of the last `update`
+	bool isRelevant(ConnectionHandle connection, EntityRef entity) const;
+	// sorted entities relevant to the connection as of the last `update`, returns false if everything is relevant (no viewer)
+	bool getRelevantEntities(ConnectionHandle connection, Array<EntityRef>& entities) const;
+
+	// sends enter / leave events for changes since the last update
+	void update();
+	// (connection, entity, entered), do not add or remove entities or viewers in handlers
+	DelegateList<void (ConnectionHandle, EntityRef, bool)>& onChanged() { return m_changed; }
+
+private:
+	struct CellCoord {
+		i32 x;
+		i32 z;
+	};
+
+	struct Cell {
+		Cell(IAllocator& allocator) : entities(allocator) {}
+
+		CellCoord coord;
+		Array<EntityRef> entities;
+	};
+
+	struct CellRange {
+		bool contains(const CellCoord& c) const { return c.x >= from.x && c.x <= to.x && c.z >= from.z && c.z <= to.z; }
+
+		CellCoord from;
+		CellCoord to;
+	};
+
+	struct TrackedEntity {
+		EntityRef entity;
+		CellCoord cell;
+		// cell viewers were told about in the last update
+		CellCoord reported_cell;
+		bool is_reported = false;
+		bool is_moved = false;
+	};
+
+	struct Viewer {
+		ConnectionHandle connection;
+		CellRange range;
+		// range the connection's interest set was computed for in the last update
+		CellRange reported_range;
+		bool is_reported = false;
+		bool is_moved = false;
+	};
+
+	static u64 getCellKey(const CellCoord& c) { return (u64(u32(c.x)) << 32) | u32(c.z); }
+	CellCoord getCell(const DVec3& pos) const;
+	Cell* findCell(const CellCoord& c) const;
+	Cell& getOrCreateCell(const CellCoord& c);
+	void removeFromCell(EntityRef entity, const CellCoord& c);
+	template <typename F> void forEachCell(const CellRange& range, F&& f) const;
+	// whether the viewer was told about the entity in the last update
+	static bool isReported(const Viewer& viewer, const TrackedEntity& entity);
+	void updateViewer(Viewer& viewer);
+	void onEntityTransformed(EntityRef entity);
+	void notify(ConnectionHandle connection, EntityRef entity, bool entered);
+
+	IAllocator& m_allocator;
+	float m_cell_size = 32;
+	World* m_world = nullptr;
+	Array<Cell> m_cells;
+	HashMap<u64, u32> m_cell_map;
+	Array<TrackedEntity> m_entities;
+	HashMap<i32, u32> m_entity_map; // entity index -> m_entities index
+	Array<EntityRef> m_moved_entities;
+	Array<EntityRef> m_global_entities; // sorted
+	Array<Viewer> m_viewers;
+	HashMap<ConnectionHandle, u32> m_viewer_map;
+	DelegateList<void (ConnectionHandle, EntityRef, bool)> m_changed;
+};
+
+} // namespace Lumix
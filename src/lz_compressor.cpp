@@ -0,0 +1,261 @@
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/hash_map.h"
+#include "core/math.h"
+#include "core/stream.h"
+#include "lz_compressor.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace Lumix {
+
+// Sequence: token (literal count << 4 | (match length - MIN_MATCH)), extra literal count bytes if the nibble is 15,
+// literals, u16 offset, extra match length bytes if the nibble is 15. The last sequence has only literals.
+static constexpr u32 MIN_MATCH = 4;
+static constexpr u32 MAX_OFFSET = 0xffFF;
+
+static u32 read32(const u8* ptr) {
+	u32 res;
+	memcpy(&res, ptr, sizeof(res));
+	return res;
+}
+
+static u32 hash(u32 value, u32 bits) {
+	return (value * 2654435761u) >> (32 - bits);
+}
+
+LZCompressor::LZCompressor(IAllocator& allocator, Span<const u8> dictionary)
+	: m_allocator(allocator)
+{
+	// the end of the dictionary is the most useful part, it's closest to the data
+	const u32 size = minimum(dictionary.length(), MAX_DICTIONARY_SIZE);
+	const u8* dictionary_data = dictionary.begin() + (dictionary.length() - size);
+	m_dictionary_size = size;
+	m_window = (u8*)m_allocator.allocate(size + MAX_INPUT_SIZE, 8);
+	if (size > 0) memcpy(m_window, dictionary_data, size);
+
+	memset(m_dictionary_table, 0, sizeof(m_dictionary_table));
+	for (u32 i = 0; i + MIN_MATCH <= size; ++i) {
+		m_dictionary_table[hash(read32(m_window + i), HASH_BITS)] = (u16)i;
+	}
+	memcpy(m_table, m_dictionary_table, sizeof(m_table));
+}
+
+LZCompressor::~LZCompressor() {
+	m_allocator.deallocate(m_window);
+}
+
+u32 LZCompressor::compress(const void* in, u32 size, u8* out, u32 out_limit) {
+	if (size > MAX_INPUT_SIZE) return 0;
+	memcpy(getInput(), in, size);
+	return compressInput(size, out, out_limit);
+}
+
+static u8* writeLength(u8* op, const u8* op_end, u32 length) {
+	while (length >= 255) {
+		if (op == op_end) return nullptr;
+		*op++ = 255;
+		length -= 255;
+	}
+	if (op == op_end) return nullptr;
+	*op++ = (u8)length;
+	return op;
+}
+
+// writes the literals in [anchor, ip) and a match, if `match_length` is not 0
+static u8* writeSequence(u8* op, const u8* op_end, const u8* anchor, const u8* ip, u32 offset, u32 match_length) {
+	const u32 literals = u32(ip - anchor);
+	if (op == op_end) return nullptr;
+	u8* token = op++;
+	const u32 match_code = match_length ? match_length - MIN_MATCH : 0;
+	*token = u8((minimum(literals, 15u) << 4) | minimum(match_code, 15u));
+
+	if (literals >= 15) {
+		op = writeLength(op, op_end, literals - 15);
+		if (!op) return nullptr;
+	}
+	if (u32(op_end - op) < literals) return nullptr;
+	memcpy(op, anchor, literals);
+	op += literals;
+	if (!match_length) return op;
+
+	if (op_end - op < 2) return nullptr;
+	*op++ = u8(offset);
+	*op++ = u8(offset >> 8);
+	if (match_code >= 15) op = writeLength(op, op_end, match_code - 15);
+	return op;
+}
+
+u32 LZCompressor::compressInput(u32 size, u8* out, u32 out_limit) {
+	if (size > MAX_INPUT_SIZE) return 0;
+
+	// stale entries are harmless, candidates are verified, so the table is reset only to restore the dictionary
+	if (m_dictionary_size > 0) memcpy(m_table, m_dictionary_table, sizeof(m_table));
+	const u8* base = m_window;
+	const u8* ip = base + m_dictionary_size;
+	const u8* anchor = ip;
+	const u8* end = ip + size;
+	u8* op = out;
+	u8* const op_end = out + out_limit;
+
+	u32 misses = 0;
+	while (ip + MIN_MATCH <= end) {
+		const u32 value = read32(ip);
+		const u32 h = hash(value, HASH_BITS);
+		const u8* candidate = base + m_table[h];
+		m_table[h] = u16(ip - base);
+
+		if (candidate >= ip || u32(ip - candidate) > MAX_OFFSET || read32(candidate) != value) {
+			// skip faster through incompressible data
+			ip += 1 + (misses++ >> 4);
+			continue;
+		}
+
+		u32 length = MIN_MATCH;
+		while (ip + length < end && candidate[length] == ip[length]) ++length;
+
+		op = writeSequence(op, op_end, anchor, ip, u32(ip - candidate), length);
+		if (!op) return 0;
+		ip += length;
+		anchor = ip;
+		misses = 0;
+	}
+
+	op = writeSequence(op, op_end, anchor, end, 0, 0);
+	if (!op) return 0;
+	return u32(op - out);
+}
+
+static bool readLength(const u8*& ip, const u8* end, u32& length) {
+	for (;;) {
+		if (ip == end) return false;
+		const u8 byte = *ip++;
+		length += byte;
+		if (byte != 255) return true;
+	}
+}
+
+u32 LZCompressor::decompress(const u8* in, u32 size, u8* out, u32 out_limit) const {
+	const u8* ip = in;
+	const u8* const end = in + size;
+	u32 op = 0;
+	const u8* dictionary_end = m_window + m_dictionary_size;
+
+	while (ip < end) {
+		const u8 token = *ip++;
+		u32 literals = token >> 4;
+		if (literals == 15 && !readLength(ip, end, literals)) return 0;
+		if (u32(end - ip) < literals || out_limit - op < literals) return 0;
+		memcpy(out + op, ip, literals);
+		ip += literals;
+		op += literals;
+		if (ip == end) break;
+
+		if (end - ip < 2) return 0;
+		const u32 offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		u32 length = token & 0xf;
+		if (length == 15 && !readLength(ip, end, length)) return 0;
+		length += MIN_MATCH;
+		if (offset == 0 || offset > op + m_dictionary_size || out_limit - op < length) return 0;
+
+		// the match can start in the dictionary and continue in the output
+		if (offset > op) {
+			const u32 from_dictionary = minimum(offset - op, length);
+			memcpy(out + op, dictionary_end - (offset - op), from_dictionary);
+			op += from_dictionary;
+			length -= from_dictionary;
+		}
+		if (offset >= length) {
+			memcpy(out + op, out + op - offset, length);
+			op += length;
+		}
+		else {
+			// overlapping, repeats the last `offset` bytes
+			for (u32 i = 0; i < length; ++i, ++op) out[op] = out[op - offset];
+		}
+	}
+	return op;
+}
+
+namespace {
+
+struct DictionaryCandidate {
+	u32 sample;
+	u32 offset;
+	u32 length;
+	u64 score;
+};
+
+}
+
+static constexpr u32 TRAIN_GRAM_SIZE = 6;
+static constexpr u32 TRAIN_SEGMENT_SIZE = 48;
+
+static u64 readGram(const u8* ptr) {
+	u64 res = 0;
+	memcpy(&res, ptr, TRAIN_GRAM_SIZE);
+	return res;
+}
+
+static u64 scoreSegment(const HashMap<u64, u32>& frequencies, const u8* data, u32 length) {
+	u64 score = 0;
+	for (u32 i = 0; i + TRAIN_GRAM_SIZE <= length; ++i) {
+		auto iter = frequencies.find(readGram(data + i));
+		// grams seen only once are not worth a place in the dictionary
+		if (iter.isValid() && iter.value() > 1) score += iter.value();
+	}
+	return score;
+}
+
+static int compareCandidates(const void* a, const void* b) {
+	const u64 sa = ((const DictionaryCandidate*)a)->score;
+	const u64 sb = ((const DictionaryCandidate*)b)->score;
+	return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+// Simplified COVER: split samples to segments, score them by how common their substrings are, take the best
+// and forget substrings already in the dictionary, so the rest of the dictionary covers something else.
+void LZCompressor::trainDictionary(IAllocator& allocator, Span<const Span<const u8>> samples, u32 max_size, OutputMemoryStream& dictionary) {
+	dictionary.clear();
+	max_size = minimum(max_size, MAX_DICTIONARY_SIZE);
+
+	HashMap<u64, u32> frequencies(allocator);
+	for (const Span<const u8>& sample : samples) {
+		for (u32 i = 0; i + TRAIN_GRAM_SIZE <= sample.length(); ++i) {
+			const u64 gram = readGram(sample.begin() + i);
+			auto iter = frequencies.find(gram);
+			if (iter.isValid()) ++iter.value();
+			else frequencies.insert(gram, 1);
+		}
+	}
+
+	Array<DictionaryCandidate> candidates(allocator);
+	for (u32 s = 0; s < samples.length(); ++s) {
+		const Span<const u8>& sample = samples[s];
+		for (u32 offset = 0; offset < sample.length(); offset += TRAIN_SEGMENT_SIZE) {
+			DictionaryCandidate& c = candidates.emplace();
+			c.sample = s;
+			c.offset = offset;
+			c.length = minimum(TRAIN_SEGMENT_SIZE, sample.length() - offset);
+			c.score = scoreSegment(frequencies, sample.begin() + offset, c.length);
+		}
+	}
+	if (candidates.empty()) return;
+	qsort(candidates.begin(), candidates.size(), sizeof(candidates[0]), &compareCandidates);
+
+	for (const DictionaryCandidate& c : candidates) {
+		if (c.score == 0 || dictionary.size() + c.length > max_size) continue;
+		const u8* data = samples[c.sample].begin() + c.offset;
+		// most of the segment is already covered
+		if (scoreSegment(frequencies, data, c.length) * 2 < c.score) continue;
+
+		dictionary.write(data, c.length);
+		for (u32 i = 0; i + TRAIN_GRAM_SIZE <= c.length; ++i) {
+			auto iter = frequencies.find(readGram(data + i));
+			if (iter.isValid()) iter.value() = 0;
+		}
+	}
+}
+
+} // namespace Lumix
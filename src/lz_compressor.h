@@ -0,0 +1,44 @@
+#pragma once
+
+#include "core/core.h"
+
+namespace Lumix {
+
+struct IAllocator;
+struct OutputMemoryStream;
+
+// Fast LZ77 compressor for datagrams, byte aligned sequences similar to LZ4 (token with literal and match
+// lengths, literals, 16bit offset). It can be primed with a dictionary of typical packets, matches can then
+// reference the dictionary, which helps a lot with small packets. Both sides must use the same dictionary.
+// Not thread safe, ENet uses a compressor per host.
+struct LZCompressor {
+	static constexpr u32 MAX_INPUT_SIZE = 4096; // ENET_PROTOCOL_MAXIMUM_MTU
+	static constexpr u32 MAX_DICTIONARY_SIZE = 32 * 1024;
+
+	LZCompressor(IAllocator& allocator, Span<const u8> dictionary);
+	~LZCompressor();
+
+	// the data can be written directly to `getInput`, followed by `compressInput`
+	u8* getInput() { return m_window + m_dictionary_size; }
+	// returns compressed size, 0 if it does not fit in `out_limit`
+	u32 compressInput(u32 size, u8* out, u32 out_limit);
+	u32 compress(const void* in, u32 size, u8* out, u32 out_limit);
+	// returns decompressed size, 0 if the input is malformed or does not fit in `out_limit`
+	u32 decompress(const u8* in, u32 size, u8* out, u32 out_limit) const;
+
+	// builds a dictionary from the most common substrings of `samples`
+	static void trainDictionary(IAllocator& allocator, Span<const Span<const u8>> samples, u32 max_size, OutputMemoryStream& dictionary);
+
+private:
+	static constexpr u32 HASH_BITS = 12;
+
+	IAllocator& m_allocator;
+	// dictionary followed by the input
+	u8* m_window;
+	u32 m_dictionary_size;
+	u16 m_table[1 << HASH_BITS];
+	// m_table with just the dictionary, copied to m_table before every datagram
+	u16 m_dictionary_table[1 << HASH_BITS];
+};
+
+} // namespace Lumix
@@ -1,16 +1,32 @@
+#include "bit_stream.h"
+#include "crc32c.h"
 #include "core/allocator.h"
 #include "core/array.h"
+#include "core/atomic.h"
 #include "core/delegate.h"
+#include "core/hash.h"
+#include "core/hash_map.h"
 #include "core/log.h"
+#include "core/math.h"
+#include "core/os.h"
 #include "core/profiler.h"
 #include "core/stream.h"
 #include "core/string.h"
+#include "core/sync.h"
+#include "core/thread.h"
 #include "engine/engine.h"
 #include "engine/plugin.h"
 #include "enet/enet.h"
+#include "interest.h"
+#include "lz_compressor.h"
 #include "lua/lua_wrapper.h"
 #include "lua/lua_script_system.h"
 #include "net.h"
+#include "net_queue.h"
+#include "packet_pool.h"
+#include "replication.h"
+#include "rpc.h"
+#include "varint.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 #pragma comment(lib, "wininet.lib")
@@ -20,6 +36,430 @@ namespace Lumix
 {
 
 
+// ENet's allocation callbacks do not carry any context
+static PacketPool* g_packet_pool = nullptr;
+
+static void* ENET_CALLBACK enetMalloc(size_t size) { return g_packet_pool->allocate(size); }
+static void ENET_CALLBACK enetFree(void* ptr) { g_packet_pool->deallocate(ptr); }
+
+
+static enet_uint32 ENET_CALLBACK enetCRC32C(const ENetBuffer* buffers, size_t buffer_count) {
+	u32 crc = 0;
+	for (size_t i = 0; i < buffer_count; ++i) crc = crc32c(buffers[i].data, buffers[i].dataLength, crc);
+	// same byte order as enet_crc32
+	return ENET_HOST_TO_NET_32(crc);
+}
+
+
+// context of the LZ ENetCompressor, owned by the host
+struct LZCompressorContext {
+	LZCompressorContext(IAllocator& allocator, Span<const u8> dictionary)
+		: allocator(allocator)
+		, compressor(allocator, dictionary)
+	{}
+
+	IAllocator& allocator;
+	LZCompressor compressor;
+};
+
+static size_t ENET_CALLBACK lzCompress(void* context, const ENetBuffer* in_buffers, size_t in_buffer_count, size_t in_limit, enet_uint8* out, size_t out_limit) {
+	LZCompressor& compressor = ((LZCompressorContext*)context)->compressor;
+	if (in_limit > LZCompressor::MAX_INPUT_SIZE) return 0;
+
+	// gather the datagram right after the dictionary, so matches can reach into it
+	u8* input = compressor.getInput();
+	u32 size = 0;
+	for (size_t i = 0; i < in_buffer_count; ++i) {
+		memcpy(input + size, in_buffers[i].data, in_buffers[i].dataLength);
+		size += (u32)in_buffers[i].dataLength;
+	}
+	return compressor.compressInput(size, out, (u32)out_limit);
+}
+
+static size_t ENET_CALLBACK lzDecompress(void* context, const enet_uint8* in, size_t in_limit, enet_uint8* out, size_t out_limit) {
+	const LZCompressor& compressor = ((LZCompressorContext*)context)->compressor;
+	return compressor.decompress(in, (u32)in_limit, out, (u32)out_limit);
+}
+
+static void ENET_CALLBACK lzDestroy(void* context) {
+	LZCompressorContext* ctx = (LZCompressorContext*)context;
+	LUMIX_DELETE(ctx->allocator, ctx);
+}
+
+
+// Lua API of bit streams, writer:getData() returns a string which can be passed as an RPC argument
+// and read by Network.createBitReader(data) on the other side
+static const char* BIT_WRITER_METATABLE = "Lumix.BitWriter";
+static const char* BIT_READER_METATABLE = "Lumix.BitReader";
+
+struct LuaBitWriter {
+	explicit LuaBitWriter(IAllocator& allocator)
+		: blob(allocator)
+		, writer(blob)
+	{}
+
+	OutputMemoryStream blob;
+	BitWriter writer;
+};
+
+static void destroyBitWriter(void* ptr) {
+	((LuaBitWriter*)ptr)->~LuaBitWriter();
+}
+
+static LuaBitWriter& checkBitWriter(lua_State* L) {
+	return *(LuaBitWriter*)luaL_checkudata(L, 1, BIT_WRITER_METATABLE);
+}
+
+// the data follows the reader in the same userdata
+static BitReader& checkBitReader(lua_State* L) {
+	return *(BitReader*)luaL_checkudata(L, 1, BIT_READER_METATABLE);
+}
+
+static void checkQuantization(lua_State* L, int idx, float& min, float& max, float& precision) {
+	min = LuaWrapper::checkArg<float>(L, idx);
+	max = LuaWrapper::checkArg<float>(L, idx + 1);
+	precision = LuaWrapper::checkArg<float>(L, idx + 2);
+	if (!(max > min)) luaL_argerror(L, idx + 1, "max must be greater than min");
+	if (!(precision > 0)) luaL_argerror(L, idx + 2, "precision must be positive");
+}
+
+static u32 checkQuatBits(lua_State* L, int idx) {
+	const i32 bits = LuaWrapper::checkArg<i32>(L, idx);
+	if (bits < 2 || bits > 31) luaL_argerror(L, idx, "bits must be in [2, 31]");
+	return (u32)bits;
+}
+
+static int bitWriterWriteBool(lua_State* L) {
+	checkBitWriter(L).writer.writeBool(LuaWrapper::checkArg<bool>(L, 2));
+	return 0;
+}
+
+static int bitWriterWriteInt(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	const i32 value = LuaWrapper::checkArg<i32>(L, 2);
+	const i32 min = LuaWrapper::checkArg<i32>(L, 3);
+	const i32 max = LuaWrapper::checkArg<i32>(L, 4);
+	if (min > max) luaL_argerror(L, 4, "max must not be less than min");
+	if (value < min || value > max) luaL_argerror(L, 2, "value out of range");
+	w.writer.writeInt(value, min, max);
+	return 0;
+}
+
+static int bitWriterWriteVarint(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	const double value = LuaWrapper::checkArg<double>(L, 2);
+	const double max = LuaWrapper::checkArg<double>(L, 3);
+	if (!(max >= 0 && max <= 0xffFFffFF)) luaL_argerror(L, 3, "max out of range");
+	if (!(value >= 0 && value <= max)) luaL_argerror(L, 2, "value out of range");
+	w.writer.writeVarint((u32)value, (u32)max);
+	return 0;
+}
+
+static int bitWriterWriteFloat(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	const float value = LuaWrapper::checkArg<float>(L, 2);
+	float min, max, precision;
+	checkQuantization(L, 3, min, max, precision);
+	w.writer.writeFloat(value, min, max, precision);
+	return 0;
+}
+
+static int bitWriterWriteVec3(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	const Vec3 value = LuaWrapper::checkArg<Vec3>(L, 2);
+	float min, max, precision;
+	checkQuantization(L, 3, min, max, precision);
+	w.writer.writeVec3(value, min, max, precision);
+	return 0;
+}
+
+static int bitWriterWriteQuat(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	const Quat value = LuaWrapper::checkArg<Quat>(L, 2);
+	w.writer.writeQuat(value, checkQuatBits(L, 3));
+	return 0;
+}
+
+// pending bits are flushed, following writes start at the next byte, so readers call align() at the same place
+static int bitWriterGetData(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	w.writer.flush();
+	lua_pushlstring(L, (const char*)w.blob.data(), (size_t)w.blob.size());
+	return 1;
+}
+
+static int bitWriterClear(lua_State* L) {
+	LuaBitWriter& w = checkBitWriter(L);
+	w.writer.flush();
+	w.blob.clear();
+	return 0;
+}
+
+static int bitReaderReadBool(lua_State* L) {
+	LuaWrapper::push(L, checkBitReader(L).readBool());
+	return 1;
+}
+
+static int bitReaderReadInt(lua_State* L) {
+	BitReader& r = checkBitReader(L);
+	const i32 min = LuaWrapper::checkArg<i32>(L, 2);
+	const i32 max = LuaWrapper::checkArg<i32>(L, 3);
+	if (min > max) luaL_argerror(L, 3, "max must not be less than min");
+	LuaWrapper::push(L, r.readInt(min, max));
+	return 1;
+}
+
+static int bitReaderReadVarint(lua_State* L) {
+	BitReader& r = checkBitReader(L);
+	const double max = LuaWrapper::checkArg<double>(L, 2);
+	if (!(max >= 0 && max <= 0xffFFffFF)) luaL_argerror(L, 2, "max out of range");
+	LuaWrapper::push(L, (double)r.readVarint((u32)max));
+	return 1;
+}
+
+static int bitReaderReadFloat(lua_State* L) {
+	BitReader& r = checkBitReader(L);
+	float min, max, precision;
+	checkQuantization(L, 2, min, max, precision);
+	LuaWrapper::push(L, r.readFloat(min, max, precision));
+	return 1;
+}
+
+static int bitReaderReadVec3(lua_State* L) {
+	BitReader& r = checkBitReader(L);
+	float min, max, precision;
+	checkQuantization(L, 2, min, max, precision);
+	LuaWrapper::push(L, r.readVec3(min, max, precision));
+	return 1;
+}
+
+static int bitReaderReadQuat(lua_State* L) {
+	BitReader& r = checkBitReader(L);
+	LuaWrapper::push(L, r.readQuat(checkQuatBits(L, 2)));
+	return 1;
+}
+
+static int bitReaderAlign(lua_State* L) {
+	checkBitReader(L).align();
+	return 0;
+}
+
+static int bitReaderIsValid(lua_State* L) {
+	LuaWrapper::push(L, checkBitReader(L).isValid());
+	return 1;
+}
+
+static void createMetatable(lua_State* L, const char* name, Span<const luaL_Reg> methods) {
+	luaL_newmetatable(L, name);
+	lua_createtable(L, 0, methods.length());
+	for (const luaL_Reg& method : methods) {
+		lua_pushcfunction(L, method.func, method.name);
+		lua_setfield(L, -2, method.name);
+	}
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
+
+static void registerBitStreamMetatables(lua_State* L) {
+	static const luaL_Reg writer_methods[] = {
+		{"writeBool", &bitWriterWriteBool},
+		{"writeInt", &bitWriterWriteInt},
+		{"writeVarint", &bitWriterWriteVarint},
+		{"writeFloat", &bitWriterWriteFloat},
+		{"writeVec3", &bitWriterWriteVec3},
+		{"writeQuat", &bitWriterWriteQuat},
+		{"getData", &bitWriterGetData},
+		{"clear", &bitWriterClear},
+	};
+	static const luaL_Reg reader_methods[] = {
+		{"readBool", &bitReaderReadBool},
+		{"readInt", &bitReaderReadInt},
+		{"readVarint", &bitReaderReadVarint},
+		{"readFloat", &bitReaderReadFloat},
+		{"readVec3", &bitReaderReadVec3},
+		{"readQuat", &bitReaderReadQuat},
+		{"align", &bitReaderAlign},
+		{"isValid", &bitReaderIsValid},
+	};
+	createMetatable(L, BIT_WRITER_METATABLE, Span<const luaL_Reg>(writer_methods, lengthOf(writer_methods)));
+	createMetatable(L, BIT_READER_METATABLE, Span<const luaL_Reg>(reader_methods, lengthOf(reader_methods)));
+}
+
+
+// outgoing operation queued by the game thread for the network thread
+struct NetCommand {
+	enum class Type : u8 {
+		SEND,
+		// sends `packet` to `target_count` BroadcastTargets stored after its payload
+		BROADCAST,
+		DISCONNECT
+	};
+
+	Type type;
+	u8 channel;
+	u32 connect_id; // detects peers which were reused by another connection before the command was processed
+	u32 target_count;
+	ENetPeer* peer;
+	ENetPacket* packet;
+};
+
+
+struct BroadcastTarget {
+	ENetPeer* peer;
+	u32 connect_id;
+};
+
+
+// targets of a BROADCAST live in the packet's memory after the payload, so they need no allocation of their own
+// and stay valid until the packet is destroyed
+static u32 getBroadcastTargetsOffset(u32 payload_size) {
+	return (payload_size + alignof(BroadcastTarget) - 1) & ~u32(alignof(BroadcastTarget) - 1);
+}
+
+
+// Owns servicing of ENet hosts in threaded mode. Outgoing packets come through `m_commands`,
+// events go to the game thread through `m_events`. Rare operations (creating hosts, connecting)
+// are done by the game thread directly while holding `m_mutex`. Between services the thread blocks
+// on sockets of its hosts until a datagram arrives, a host has to resend or ping, `wake` is called
+// or a tick passes.
+struct NetThread : Thread {
+	NetThread(IAllocator& allocator, u32 tick_rate)
+		: Thread(allocator)
+		, m_hosts(allocator)
+		, m_polled_sockets(allocator)
+		, m_commands(allocator, 64 * 1024)
+		, m_events(allocator, 64 * 1024)
+		, m_deferred_events(allocator)
+		, m_tick_rate((i32)tick_rate)
+	{
+		// without a poller the thread sleeps for whole ticks
+		m_poller = enet_socket_poller_create();
+	}
+
+	~NetThread() {
+		if (m_poller) enet_socket_poller_destroy(m_poller);
+	}
+
+	int task() override {
+		profiler::setThreadName("Network");
+		while (m_finished == 0) {
+			u32 timeout = 1000 / (u32)m_tick_rate;
+			{
+				PROFILE_BLOCK("service");
+				MutexGuard guard(m_mutex);
+				service();
+				// with full m_events, undispatched events would keep the timeout at 0
+				if (!m_events.isFull()) {
+					for (ENetHost* host : m_hosts) timeout = enet_host_service_timeout(host, timeout);
+				}
+			}
+			// ENet time has millisecond resolution
+			timeout = maximum(timeout, 1u);
+			if (m_poller) enet_socket_poller_wait(m_poller, timeout);
+			else os::sleep(timeout);
+		}
+
+		MutexGuard guard(m_mutex);
+		processCommands();
+		for (ENetHost* host : m_hosts) enet_host_flush(host);
+		return 0;
+	}
+
+	void processCommands() {
+		NetCommand cmd;
+		while (m_commands.pop(cmd)) {
+			const bool is_same_connection = cmd.peer && cmd.peer->connectID == cmd.connect_id;
+			switch (cmd.type) {
+				case NetCommand::Type::SEND:
+					if (!is_same_connection || enet_peer_send(cmd.peer, cmd.channel, cmd.packet) != 0) {
+						if (cmd.packet->referenceCount == 0) enet_packet_destroy(cmd.packet);
+					}
+					break;
+				case NetCommand::Type::BROADCAST: {
+					const BroadcastTarget* targets = (const BroadcastTarget*)(cmd.packet->data + getBroadcastTargetsOffset((u32)cmd.packet->dataLength));
+					for (u32 i = 0; i < cmd.target_count; ++i) {
+						if (targets[i].peer->connectID == targets[i].connect_id) enet_peer_send(targets[i].peer, cmd.channel, cmd.packet);
+					}
+					if (cmd.packet->referenceCount == 0) enet_packet_destroy(cmd.packet);
+					break;
+				}
+				case NetCommand::Type::DISCONNECT:
+					if (is_same_connection && cmd.peer->state != ENET_PEER_STATE_DISCONNECTED) {
+						enet_peer_disconnect(cmd.peer, 0);
+					}
+					break;
+			}
+		}
+	}
+
+	// called by the game thread after it queues commands, wakes the thread once until it services hosts
+	void wake() {
+		if (m_poller && m_wake_pending.compareExchange(1, 0)) enet_socket_poller_wake(m_poller);
+	}
+
+	void finish() {
+		m_finished = 1;
+		if (m_poller) enet_socket_poller_wake(m_poller);
+	}
+
+	// caller holds `m_mutex`, the thread updates the poller itself, so it's never changed while the thread waits on it
+	void addHost(ENetHost* host) {
+		m_hosts.push(host);
+		m_hosts_changed = true;
+		wake();
+	}
+
+	void removeHost(ENetHost* host) {
+		m_hosts.eraseItem(host);
+		m_hosts_changed = true;
+		wake();
+	}
+
+	void updatePoller() {
+		m_hosts_changed = false;
+		if (!m_poller) return;
+
+		// sockets of destroyed hosts are already closed and removed by the OS, removing them fails harmlessly
+		for (ENetSocket socket : m_polled_sockets) enet_socket_poller_remove(m_poller, socket);
+		m_polled_sockets.clear();
+		for (ENetHost* host : m_hosts) {
+			// hosts which do not fit are still serviced every tick
+			if (enet_socket_poller_add(m_poller, host->socket) == 0) m_polled_sockets.push(host->socket);
+		}
+	}
+
+	void service() {
+		// commands queued from now on wake the thread again
+		m_wake_pending = 0;
+		if (m_hosts_changed) updatePoller();
+		processCommands();
+
+		ENetEvent e;
+		for (ENetHost* host : m_hosts) {
+			// enet_host_service returns at most one event, so there's always room for it
+			while (!m_events.isFull() && enet_host_service(host, &e, 0) > 0) {
+				m_events.push(e);
+			}
+			enet_host_flush(host);
+		}
+	}
+
+	Mutex m_mutex;
+	Array<ENetHost*> m_hosts;
+	bool m_hosts_changed = true;
+	ENetSocketPoller* m_poller = nullptr;
+	Array<ENetSocket> m_polled_sockets;
+	AtomicI32 m_wake_pending = 0;
+	MPSCQueue<NetCommand> m_commands;
+	SPSCQueue<ENetEvent> m_events;
+	// events taken out of `m_events` when a host was destroyed, delivered before `m_events`, game thread only
+	Array<ENetEvent> m_deferred_events;
+	// written by the game thread
+	AtomicI32 m_tick_rate;
+	AtomicI32 m_finished = 0;
+};
+
+
 struct NetSystemImpl : NetSystem 
 {
 	enum class Channel : int
@@ -27,420 +467,2345 @@ struct NetSystemImpl : NetSystem
 		RPC = 0,
 		LUA_STRING = 1,
 		USER = 2,
+		REPLICATION = 3,
+		// messages coalesced by batching, (u8 channel, varint size, data) each
+		BATCH = 4,
+		// chunked transfers, StreamMessage, never batched
+		STREAM = 5,
 
 		COUNT
 	};
+
+	static constexpr u32 INVALID_RPC_ID = 0xffFFffFF;
+	// function names a peer can announce in rpc::MessageType::FUNCTION_TABLE, names of unknown functions are kept too, for registerRPC called later
+	static constexpr u32 MAX_REMOTE_RPC_FUNCTIONS = 4096;
+	// longest name rpc::MessageType::CALL_BY_NAME can call
+	static constexpr u32 MAX_RPC_NAME_LENGTH = 127;
+	// batches are flushed before they get bigger, so they fit in one datagram with the default MTU
+	static constexpr u32 MAX_BATCH_SIZE = 1200;
+
+	// first byte of every message on the STREAM channel
+	enum class StreamMessage : u8 {
+		// sender -> receiver: varint id, varint offset, varint size, string name
+		BEGIN,
+		// varint id, varint offset, data
+		DATA,
+		// varint id, follows the last DATA
+		END,
+		// varint id, the sender canceled
+		CANCEL,
+		// receiver -> sender: varint id, varint offset of the first byte not received yet
+		ACK,
+		// varint id, the receiver canceled
+		REJECT
+	};
+
+	// DATA fits in one datagram with the default MTU
+	static constexpr u32 STREAM_CHUNK_SIZE = 1024;
+	// unacknowledged stream bytes per connection, half of ENet's default reliable window is left to other traffic
+	static constexpr u32 STREAM_WINDOW = 32 * 1024;
+	static constexpr u32 STREAM_ACK_INTERVAL = 8 * 1024;
+	// budget unused while streams wait for acknowledgements accumulates up to this many seconds
+	static constexpr float STREAM_MAX_BURST = 0.1f;
+
+	struct OutgoingStream {
+		~OutgoingStream() {
+			if (is_file) file.close();
+		}
+
+		StreamHandle handle = INVALID_STREAM;
+		ConnectionHandle connection = INVALID_CONNECTION;
+		IInputStream* input = nullptr;
+		// opened by sendFile
+		os::InputFile file;
+		bool is_file = false;
+		// offsets in the whole payload
+		u64 sent = 0;
+		u64 acked = 0;
+		u64 end = 0;
+	};
+
+	struct IncomingStream {
+		ConnectionHandle connection;
+		u32 id;
+		u64 received;
+		u64 acked;
+		u64 end;
+	};
+
+	// message of sendScheduled, the packet is created right away, so it's copied only once
+	struct ScheduledMessage {
+		ENetPacket* packet;
+		u32 key;
+		float priority;
+		// grows by `priority` each update the message waits
+		float accumulated;
+		u32 wait;
+	};
+
+	struct Batch {
+		Batch(IAllocator& allocator) : data(allocator) {}
+
+		OutputMemoryStream data;
+		u32 messages = 0;
+		u32 prefix_bytes = 0;
+		bool reliable = false;
+	};
+
+	struct Connection {
+		Connection(IAllocator& allocator)
+			: rpc_remote_functions(allocator)
+			, rpc_remote_ids(allocator)
+			, replication_client(allocator)
+			, batch(allocator)
+			, scheduled(allocator)
+			, groups(allocator)
+		{}
+
+		ENetPeer* peer = nullptr;
+		u32 connect_id = 0;
+		u16 generation = 1;
+		i32 next_free = -1;
+		bool is_server = false;
+		// index of the server shard servicing the peer, -1 if it's m_thread or the game thread
+		i32 shard = -1;
+		// last snapshot the client acknowledged, 0 if none
+		u32 replication_ack = 0;
+		// name -> id of functions the other side accepts in rpc::MessageType::CALL_BY_ID
+		HashMap<RuntimeHash, u32> rpc_remote_functions;
+		// remote id of our m_rpc_functions[i], INVALID_RPC_ID if unknown
+		Array<u32> rpc_remote_ids;
+		Replication::Client replication_client;
+		bool is_batching = false;
+		// messages of one reliability, a message of the other one flushes it first
+		Batch batch;
+		// sent by outgoing streams, not acknowledged yet
+		u32 stream_in_flight = 0;
+		// bytes per update, 0 if sendScheduled sends right away
+		u32 send_budget = 0;
+		// budget left, negative after a message overdraws it
+		i32 send_allowance = 0;
+		Array<ScheduledMessage> scheduled;
+		SchedulerStats scheduler_stats;
+		// names of groups the connection is in
+		Array<RuntimeHash> groups;
+	};
+
+	// profiler counter ids and host totals at their last push
+	struct HostCounters {
+		u32 in = 0;
+		u32 out = 0;
+		u32 total_received = 0;
+		u32 total_sent = 0;
+		u32 last_received = 0;
+		u32 last_sent = 0;
+	};
+
+	struct RPCFunction {
+		RPCFunction(IAllocator& allocator) : name(allocator) {}
+
+		String name;
+		int ref = -1;
+	};
+
+	// queued in Lua batching mode, payloads are stored in m_lua_batch_data
+	struct LuaEvent {
+		ENetEventType type;
+		ConnectionHandle connection;
+		u32 offset;
+		u32 size;
+	};
+
+	struct LuaRPC {
+		u32 func_idx;
+		u32 offset;
+		u32 size;
+	};
 		
 	NetSystemImpl(Engine& engine)
 		: m_engine(engine)
 		, m_allocator(engine.getAllocator())
+		, m_packet_pool(m_allocator)
 		, m_is_initialized(false)
+		, m_shards(m_allocator)
+		, m_compression_dictionaries{OutputMemoryStream(m_allocator), OutputMemoryStream(m_allocator)}
 		, m_connections(m_allocator)
+		, m_rpc_functions(m_allocator)
+		, m_rpc_function_lookup(m_allocator)
+		, m_rpc_blob(m_allocator)
+		, m_replication(m_allocator)
+		, m_replication_blob(m_allocator)
+		, m_interest(m_allocator)
+		, m_relevant_entities(m_allocator)
+		, m_rpc_args_blob(m_allocator)
+		, m_recipients(m_allocator)
+		, m_outgoing_streams(m_allocator)
+		, m_incoming_streams(m_allocator)
+		, m_stream_blob(m_allocator)
+		, m_lua_events(m_allocator)
+		, m_lua_rpcs(m_allocator)
+		, m_lua_batch_data(m_allocator)
 	{
-		if (enet_initialize() < 0)
+		ASSERT(!g_packet_pool);
+		g_packet_pool = &m_packet_pool;
+
+		ENetCallbacks callbacks = {};
+		callbacks.malloc = &enetMalloc;
+		callbacks.free = &enetFree;
+		if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks) < 0)
 		{
+			g_packet_pool = nullptr;
 			logError("Failed to initialize network.");
 			return;
 		}
 		m_is_initialized = true;
+		m_interest.onChanged().bind<&NetSystemImpl::onInterestChanged>(this);
+		m_batch_messages_counter = profiler::createCounter("Net messages per batch", 0);
+		m_batch_saved_counter = profiler::createCounter("Net batch header bytes saved", 0);
+
+		HostCounters& server = m_host_counters[(u32)HostType::SERVER];
+		server.in = profiler::createCounter("Net server in (B/s)", 0);
+		server.out = profiler::createCounter("Net server out (B/s)", 0);
+		server.total_received = profiler::createCounter("Net server total recv (KB)", 0);
+		server.total_sent = profiler::createCounter("Net server total send (KB)", 0);
+		HostCounters& client = m_host_counters[(u32)HostType::CLIENT];
+		client.in = profiler::createCounter("Net client in (B/s)", 0);
+		client.out = profiler::createCounter("Net client out (B/s)", 0);
+		client.total_received = profiler::createCounter("Net client total recv (KB)", 0);
+		client.total_sent = profiler::createCounter("Net client total send (KB)", 0);
+	}
+
+	void setThreaded(bool threaded, u32 tick_rate) override {
+		tick_rate = maximum(tick_rate, 1u);
+		if (threaded && m_thread) {
+			m_thread->m_tick_rate = (i32)tick_rate;
+			return;
+		}
+		if (!threaded) {
+			if (m_thread) stopThread();
+			return;
+		}
+
+		m_thread = LUMIX_NEW(m_allocator, NetThread)(m_allocator, tick_rate);
+		if (m_server_host) m_thread->addHost(m_server_host);
+		if (m_client_host) m_thread->addHost(m_client_host);
+		if (!m_thread->create("network", true)) {
+			logError("Failed to create network thread.");
+			LUMIX_DELETE(m_allocator, m_thread);
+			m_thread = nullptr;
+		}
+	}
+
+	bool isThreaded() const override { return m_thread; }
+
+	void stopThread() {
+		m_thread->finish();
+		m_thread->destroy();
+		// deliver events the thread produced before it finished
+		processThreadEvents(*m_thread, -1);
+		LUMIX_DELETE(m_allocator, m_thread);
+		m_thread = nullptr;
+	}
+
+	void initBegin() override {
+		registerLuaAPI(getLuaState());
+	}
+
+	void serialize(OutputMemoryStream& serializer) const override {}
+	bool deserialize(i32 version, InputMemoryStream& serializer) override { return version == 0; }
+
+	// function is either the id returned by registerRPC or a name, returns -1 for names which are not registered
+	i32 checkRPCFunctionArg(lua_State* L, int idx, const char*& name) {
+		if (lua_type(L, idx) == LUA_TNUMBER) {
+			const i32 func_idx = LuaWrapper::toType<i32>(L, idx);
+			if (func_idx < 0 || func_idx >= m_rpc_functions.size()) luaL_argerror(L, idx, "invalid RPC function");
+			name = m_rpc_functions[func_idx].name.c_str();
+			return func_idx;
+		}
+		name = LuaWrapper::checkArg<const char*>(L, idx);
+		return findRPCFunction(name);
+	}
+
+
+	static u32 getRemoteRPCId(const Connection& conn, i32 func_idx) {
+		return func_idx >= 0 && func_idx < conn.rpc_remote_ids.size() ? conn.rpc_remote_ids[func_idx] : INVALID_RPC_ID;
+	}
+
+
+	static void writeRPCHeader(const Connection& conn, i32 func_idx, const char* func_name, OutputMemoryStream& blob) {
+		const u32 remote_id = getRemoteRPCId(conn, func_idx);
+		if (remote_id != INVALID_RPC_ID) {
+			blob.write(rpc::MessageType::CALL_BY_ID);
+			writeVarint(blob, remote_id);
+		}
+		else {
+			blob.write(rpc::MessageType::CALL_BY_NAME);
+			rpc::writeString(blob, func_name, stringLength(func_name));
+		}
+	}
+
+
+	static int remoteCall(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+		
+		ConnectionHandle connection = LuaWrapper::checkArg<ConnectionHandle>(L, 1);
+		Connection* conn = that->getConnection(connection);
+		if (!conn) luaL_argerror(L, 1, "invalid connection");
+
+		const char* func_name;
+		const i32 func_idx = that->checkRPCFunctionArg(L, 2, func_name);
+
+		OutputMemoryStream& blob = that->m_rpc_blob;
+		blob.clear();
+		writeRPCHeader(*conn, func_idx, func_name, blob);
+		if (!rpc::writeArgs(blob, L, 3, lua_gettop(L) - 2)) {
+			logError("Can not RPC ", func_name);
+			return 0;
+		}
+
+		that->send(*conn, (int)Channel::RPC, blob.data(), (u32)blob.size(), true);
+		return 0;
+	}
+
+
+	// calls the function at stack index `func_arg`, with arguments following it, on m_recipients
+	void remoteCallShared(lua_State* L, int func_arg) {
+		const char* func_name;
+		const i32 func_idx = checkRPCFunctionArg(L, func_arg, func_name);
+
+		// arguments are the same for all connections, only function ids differ
+		OutputMemoryStream& args = m_rpc_args_blob;
+		args.clear();
+		if (!rpc::writeArgs(args, L, func_arg + 1, lua_gettop(L) - func_arg)) {
+			logError("Can not RPC ", func_name);
+			return;
+		}
+
+		// recipients which know the function by the same id share a message, usually all of them
+		Array<u32>& recipients = m_recipients;
+		for (u32 begin = 0, count = recipients.size(); begin < count; ) {
+			const Connection& first = m_connections[recipients[begin]];
+			const u32 remote_id = getRemoteRPCId(first, func_idx);
+			u32 end = begin + 1;
+			for (u32 i = end; i < count; ++i) {
+				if (getRemoteRPCId(m_connections[recipients[i]], func_idx) != remote_id) continue;
+				const u32 tmp = recipients[i];
+				recipients[i] = recipients[end];
+				recipients[end] = tmp;
+				++end;
+			}
+
+			m_rpc_blob.clear();
+			writeRPCHeader(first, func_idx, func_name, m_rpc_blob);
+			m_rpc_blob.write(args.data(), args.size());
+			sendShared(Span<const u32>(recipients.begin() + begin, end - begin), (int)Channel::RPC, m_rpc_blob.data(), (u32)m_rpc_blob.size(), true);
+			begin = end;
+		}
+	}
+
+
+	static ConnectionHandle checkExceptArg(lua_State* L, int idx) {
+		return lua_isnoneornil(L, idx) ? INVALID_CONNECTION : LuaWrapper::checkArg<ConnectionHandle>(L, idx);
+	}
+
+
+	// Network.callRelevant(entity, func, ...) calls the function on all connections the entity is relevant to
+	static int remoteCallRelevant(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+
+		const EntityRef entity = {LuaWrapper::checkArg<i32>(L, 1)};
+		that->m_recipients.clear();
+		for (u32 i = 0, c = that->m_connections.size(); i < c; ++i) {
+			const Connection& conn = that->m_connections[i];
+			if (conn.peer && that->m_interest.isRelevant(makeHandle(i, conn.generation), entity)) that->m_recipients.push(i);
+		}
+		that->remoteCallShared(L, 2);
+		return 0;
+	}
+
+
+	// Network.broadcast(except, func, ...) calls the function on all connections but `except`, which can be nil
+	static int remoteCallAll(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+		that->collectRecipients(nullptr, checkExceptArg(L, 1));
+		that->remoteCallShared(L, 2);
+		return 0;
+	}
+
+
+	// Network.callGroup(group, except, func, ...) calls the function on connections of the group but `except`, which can be nil
+	static int remoteCallGroup(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+		const RuntimeHash group(LuaWrapper::checkArg<const char*>(L, 1));
+		that->collectRecipients(&group, checkExceptArg(L, 2));
+		that->remoteCallShared(L, 3);
+		return 0;
 	}
 
-	void initBegin() override {
-		registerLuaAPI(getLuaState());
+
+	static int createBitWriter(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+		void* mem = lua_newuserdatadtor(L, sizeof(LuaBitWriter), &destroyBitWriter);
+		new (NewPlaceholder(), mem) LuaBitWriter(that->m_allocator);
+		luaL_getmetatable(L, BIT_WRITER_METATABLE);
+		lua_setmetatable(L, -2);
+		return 1;
+	}
+
+
+	static int createBitReader(lua_State* L) {
+		if (lua_type(L, 1) != LUA_TSTRING) LuaWrapper::argError(L, 1, "string");
+		size_t size;
+		const char* data = lua_tolstring(L, 1, &size);
+
+		u8* mem = (u8*)lua_newuserdata(L, sizeof(BitReader) + size);
+		u8* copy = mem + sizeof(BitReader);
+		memcpy(copy, data, size);
+		new (NewPlaceholder(), mem) BitReader(copy, (u32)size);
+		luaL_getmetatable(L, BIT_READER_METATABLE);
+		lua_setmetatable(L, -2);
+		return 1;
+	}
+
+
+	// returns a table with ConnectionStats fields or nil if the connection is not valid
+	static int getConnectionStatsLua(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+		const ConnectionHandle connection = LuaWrapper::checkArg<ConnectionHandle>(L, 1);
+		ConnectionStats stats;
+		if (!that->getConnectionStats(connection, stats)) {
+			lua_pushnil(L);
+			return 1;
+		}
+
+		lua_createtable(L, 0, 11);
+		LuaWrapper::setField(L, -1, "rtt", stats.rtt);
+		LuaWrapper::setField(L, -1, "rtt_variance", stats.rtt_variance);
+		LuaWrapper::setField(L, -1, "packet_loss", stats.packet_loss);
+		LuaWrapper::setField(L, -1, "throttle", stats.throttle);
+		LuaWrapper::setField(L, -1, "bytes_in", stats.bytes_in);
+		LuaWrapper::setField(L, -1, "bytes_out", stats.bytes_out);
+		LuaWrapper::setField(L, -1, "packets_in", stats.packets_in);
+		LuaWrapper::setField(L, -1, "packets_out", stats.packets_out);
+		LuaWrapper::setField(L, -1, "reliable_pending", stats.reliable_pending);
+		LuaWrapper::setField(L, -1, "reliable_in_transit", stats.reliable_in_transit);
+		LuaWrapper::setField(L, -1, "resends", stats.resends);
+		return 1;
+	}
+
+
+	static int setInterestCallback(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+
+		if (!lua_isfunction(L, 1)) LuaWrapper::argError(L, 1, "function");
+
+		if (that->m_lua_interest_callback_ref != -1) {
+			LuaWrapper::releaseRef(that->m_lua_callback_state, that->m_lua_interest_callback_ref);
+		}
+
+		that->m_lua_callback_state = L;
+		lua_pushvalue(L, 1);
+		that->m_lua_interest_callback_ref = LuaWrapper::createRef(L);
+		lua_pop(L, 1);
+		return 0;
+	}
+
+
+	void onInterestChanged(ConnectionHandle connection, EntityRef entity, bool entered) {
+		if (m_lua_interest_callback_ref == -1) return;
+
+		lua_State* L = m_lua_callback_state;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, m_lua_interest_callback_ref);
+		LuaWrapper::push(L, connection);
+		LuaWrapper::push(L, entity.index);
+		LuaWrapper::push(L, entered);
+		if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
+			logError(lua_tostring(L, -1));
+			lua_pop(L, 1);
+		}
+	}
+
+
+	// Lua API of interest management, entities are passed as entity indices
+	void setViewer(ConnectionHandle connection, const DVec3& pos, float radius) { m_interest.setViewer(connection, pos, radius); }
+	void removeViewer(ConnectionHandle connection) { m_interest.removeViewer(connection); }
+	void addInterestEntity(i32 entity, const DVec3& pos) { m_interest.addEntity({entity}, pos); }
+	void removeInterestEntity(i32 entity) { m_interest.removeEntity({entity}); }
+	void setInterestEntityPosition(i32 entity, const DVec3& pos) { m_interest.setPosition({entity}, pos); }
+	bool isRelevant(ConnectionHandle connection, i32 entity) { return m_interest.isRelevant(connection, {entity}); }
+
+
+	static int registerRPC(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+		const char* name = LuaWrapper::checkArg<const char*>(L, 1);
+		if (!lua_isfunction(L, 2)) LuaWrapper::argError(L, 2, "function");
+
+		lua_pushvalue(L, 2);
+		const u32 idx = that->registerRPCFunction(name, L);
+		lua_pop(L, 1);
+
+		LuaWrapper::push(L, idx);
+		return 1;
+	}
+
+
+	// registers the function on top of the stack, returns its id
+	u32 registerRPCFunction(const char* name, lua_State* L) {
+		const i32 existing = findRPCFunction(name);
+		if (existing >= 0) {
+			RPCFunction& f = m_rpc_functions[existing];
+			LuaWrapper::releaseRef(L, f.ref);
+			f.ref = LuaWrapper::createRef(L);
+			return existing;
+		}
+
+		const u32 idx = m_rpc_functions.size();
+		RPCFunction& f = m_rpc_functions.emplace(m_allocator);
+		f.name = name;
+		f.ref = LuaWrapper::createRef(L);
+		m_rpc_function_lookup.insert(RuntimeHash(name), idx);
+
+		// connections which already know the remote id of this name can call it by id now
+		for (Connection& c : m_connections) {
+			if (!c.peer) continue;
+			resolveRemoteRPC(c, idx);
+			sendRPCFunctionTable(c, idx, idx + 1);
+		}
+		return idx;
+	}
+
+
+	i32 findRPCFunction(const char* name) const {
+		auto iter = m_rpc_function_lookup.find(RuntimeHash(name));
+		return iter.isValid() ? (i32)iter.value() : -1;
+	}
+
+
+	void resolveRemoteRPC(Connection& c, u32 func_idx) {
+		auto iter = c.rpc_remote_functions.find(RuntimeHash(m_rpc_functions[func_idx].name.c_str()));
+		if (!iter.isValid()) return;
+
+		while ((u32)c.rpc_remote_ids.size() <= func_idx) c.rpc_remote_ids.push(INVALID_RPC_ID);
+		c.rpc_remote_ids[func_idx] = iter.value();
+	}
+
+
+	// tells the other side which ids it can use to call our functions [from, to)
+	void sendRPCFunctionTable(Connection& c, u32 from, u32 to) {
+		if (from >= to) return;
+
+		m_rpc_blob.clear();
+		m_rpc_blob.write(rpc::MessageType::FUNCTION_TABLE);
+		writeVarint(m_rpc_blob, to - from);
+		for (u32 i = from; i < to; ++i) {
+			const String& name = m_rpc_functions[i].name;
+			writeVarint(m_rpc_blob, i);
+			rpc::writeString(m_rpc_blob, name.c_str(), name.length());
+		}
+		send(c, (int)Channel::RPC, m_rpc_blob.data(), (u32)m_rpc_blob.size(), true);
+	}
+
+
+	static int setCallback(lua_State* L) {
+		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+
+		if (!lua_isfunction(L, 1)) LuaWrapper::argError(L, 1, "function");
+
+		if (that->m_lua_callback_ref != -1) {
+			LuaWrapper::releaseRef(that->m_lua_callback_state, that->m_lua_callback_ref);
+		}
+		// the table of batches belongs to the old callback's state
+		if (that->m_lua_events_ref != -1) {
+			LuaWrapper::releaseRef(that->m_lua_callback_state, that->m_lua_events_ref);
+			that->m_lua_events_ref = -1;
+			that->m_lua_events_size = 0;
+		}
+
+		that->m_lua_callback_state = L;
+		lua_pushvalue(L, 1);
+		that->m_lua_callback_ref = LuaWrapper::createRef(L);
+		lua_pop(L, 1);
+		return 0;
+	}
+
+
+	void registerLuaAPI(lua_State* L)
+	{
+		#define REGISTER_FUNCTION(name) \
+			do {\
+				auto f = &LuaWrapper::wrapMethodClosure<&NetSystemImpl::name>; \
+				LuaWrapper::createSystemClosure(L, "Network", this, #name, f); \
+			} while(false) \
+
+			LuaWrapper::createSystemClosure(L, "Network", this, "setCallback", &NetSystemImpl::setCallback);
+			LuaWrapper::createSystemClosure(L, "Network", this, "call", &NetSystemImpl::remoteCall);
+			LuaWrapper::createSystemClosure(L, "Network", this, "registerRPC", &NetSystemImpl::registerRPC);
+			LuaWrapper::createSystemClosure(L, "Network", this, "callRelevant", &NetSystemImpl::remoteCallRelevant);
+			LuaWrapper::createSystemClosure(L, "Network", this, "broadcast", &NetSystemImpl::remoteCallAll);
+			LuaWrapper::createSystemClosure(L, "Network", this, "callGroup", &NetSystemImpl::remoteCallGroup);
+			LuaWrapper::createSystemClosure(L, "Network", this, "setInterestCallback", &NetSystemImpl::setInterestCallback);
+			registerBitStreamMetatables(L);
+			LuaWrapper::createSystemClosure(L, "Network", this, "createBitWriter", &NetSystemImpl::createBitWriter);
+			LuaWrapper::createSystemClosure(L, "Network", this, "createBitReader", &NetSystemImpl::createBitReader);
+			LuaWrapper::createSystemClosure(L, "Network", this, "getConnectionStats", &NetSystemImpl::getConnectionStatsLua);
+			REGISTER_FUNCTION(createServer);
+			REGISTER_FUNCTION(createShardedServer);
+			REGISTER_FUNCTION(connect);
+			REGISTER_FUNCTION(sendString);
+			REGISTER_FUNCTION(broadcastString);
+			REGISTER_FUNCTION(sendStringToGroup);
+			REGISTER_FUNCTION(addToGroup);
+			REGISTER_FUNCTION(removeFromGroup);
+			REGISTER_FUNCTION(eventPacketToString);
+			REGISTER_FUNCTION(disconnect); 
+			REGISTER_FUNCTION(setThreaded);
+			REGISTER_FUNCTION(setViewer);
+			REGISTER_FUNCTION(removeViewer);
+			REGISTER_FUNCTION(addInterestEntity);
+			REGISTER_FUNCTION(removeInterestEntity);
+			REGISTER_FUNCTION(setInterestEntityPosition);
+			REGISTER_FUNCTION(isRelevant);
+			REGISTER_FUNCTION(setBatching);
+			REGISTER_FUNCTION(setSendBudget);
+			REGISTER_FUNCTION(setLuaBatching);
+			REGISTER_FUNCTION(flush);
+
+		#undef REGISTER_FUNCTION
+	}
+
+	
+	~NetSystemImpl() override
+	{
+		if (!m_is_initialized) return;
+
+		if (m_thread) {
+			m_thread->finish();
+			m_thread->destroy();
+			for (const ENetEvent& e : m_thread->m_deferred_events) {
+				if (e.packet) enet_packet_destroy(e.packet);
+			}
+			ENetEvent e;
+			while (m_thread->m_events.pop(e)) {
+				if (e.packet) enet_packet_destroy(e.packet);
+			}
+			LUMIX_DELETE(m_allocator, m_thread);
+		}
+		// shard hosts reset their peers
+		destroyShards();
+
+		for(Connection& c : m_connections)
+		{
+			for (const ScheduledMessage& msg : c.scheduled) enet_packet_destroy(msg.packet);
+			if (!c.peer || c.shard >= 0) continue;
+			enet_peer_reset(c.peer);
+		}
+
+		if (m_server_host) enet_host_destroy(m_server_host);
+		if (m_client_host) enet_host_destroy(m_client_host);
+
+		for (OutgoingStream* s : m_outgoing_streams) LUMIX_DELETE(m_allocator, s);
+		if (m_lua_events_ref != -1) LuaWrapper::releaseRef(m_lua_callback_state, m_lua_events_ref);
+
+		enet_deinitialize();
+		g_packet_pool = nullptr;
+	}
+
+
+	static const char* getEventString(const ENetEvent& event)
+	{
+		if (!event.packet) return "";
+		if (event.packet->dataLength == 0) return "";
+		if (event.packet->data[event.packet->dataLength - 1] != '\0') return "";
+		return (const char*)event.packet->data;
+	}
+
+
+	const char* eventPacketToString(ENetEvent* event) { return getEventString(*event); }
+
+
+	// In batching mode events and RPCs received during `update` are delivered at its end, the callback gets
+	// (count, events) once instead of (type, connection, event) per event. `events` is a table reused by all
+	// batches, the i-th event is at 3 * i - 2 .. 3 * i as type, connection and its string, "" if there's none.
+	// RPCs are called after the callback, in one protected call. A connect or disconnect event first delivers
+	// what was queued before it if there are RPCs, so they don't run after their connection's disconnect.
+	void setLuaBatching(bool enabled) { m_is_lua_batching = enabled; }
+
+
+	void callLuaCallback(const ENetEvent& event, ConnectionHandle connection)
+	{
+		if (m_lua_callback_ref == -1) return;
+
+		if (m_is_lua_batching) {
+			if (event.type != ENET_EVENT_TYPE_RECEIVE && !m_lua_rpcs.empty()) dispatchLuaBatch();
+			const char* str = getEventString(event);
+			LuaEvent& e = m_lua_events.emplace();
+			e.type = event.type;
+			e.connection = connection;
+			e.offset = (u32)m_lua_batch_data.size();
+			e.size = stringLength(str);
+			m_lua_batch_data.write(str, e.size);
+			return;
+		}
+
+		lua_rawgeti(m_lua_callback_state, LUA_REGISTRYINDEX, m_lua_callback_ref);
+
+		LuaWrapper::push(m_lua_callback_state, (int)event.type);
+		LuaWrapper::push(m_lua_callback_state, connection);
+		LuaWrapper::push(m_lua_callback_state, &event);
+		if (lua_pcall(m_lua_callback_state, 3, 0, 0) != LUA_OK)
+		{
+			logError(lua_tostring(m_lua_callback_state, -1));
+			lua_pop(m_lua_callback_state, 1);
+		}
+	}
+
+
+	// Handles are `generation << 16 | index`, so a handle of a closed connection does not address
+	// a new connection reusing the same slot. Generations start at 1, handles are never 0.
+	static ConnectionHandle makeHandle(u32 index, u32 generation) { return ConnectionHandle((generation << 16) | index); }
+	static u32 getIndex(ConnectionHandle handle) { return u32(handle) & 0xffFF; }
+	static u32 getGeneration(ConnectionHandle handle) { return u32(handle) >> 16; }
+
+	Connection* getConnection(ConnectionHandle handle)
+	{
+		if (handle <= 0) return nullptr;
+		const u32 idx = getIndex(handle);
+		if (idx >= (u32)m_connections.size()) return nullptr;
+		Connection& conn = m_connections[idx];
+		if (conn.generation != getGeneration(handle) || !conn.peer) return nullptr;
+		return &conn;
+	}
+
+	// thread servicing the host of the connection, null if it's the game thread
+	NetThread* getThread(const Connection& c) const { return c.shard < 0 ? m_thread : m_shards[c.shard]; }
+
+	// the handle is stored in ENetPeer::data
+	ConnectionHandle getConnectionHandle(const ENetPeer* peer)
+	{
+		if (!peer) return INVALID_CONNECTION;
+		const ConnectionHandle handle = (ConnectionHandle)(uintptr)peer->data;
+		const Connection* conn = getConnection(handle);
+		if (!conn || conn->peer != peer) return INVALID_CONNECTION;
+		return handle;
+	}
+
+	// in threaded mode `connect` can reuse the event's peer before the game thread processes the event,
+	// so the peer's handle is used only if the connection ids match
+	ConnectionHandle getEventConnection(const ENetEvent& event)
+	{
+		const ConnectionHandle handle = getConnectionHandle(event.peer);
+		if (handle == INVALID_CONNECTION) return INVALID_CONNECTION;
+		if (m_connections[getIndex(handle)].connect_id == event.connectID) return handle;
+
+		for (u32 i = 0, c = m_connections.size(); i < c; ++i) {
+			const Connection& conn = m_connections[i];
+			if (conn.peer == event.peer && conn.connect_id == event.connectID) return makeHandle(i, conn.generation);
+		}
+		return INVALID_CONNECTION;
+	}
+
+	lua_State* getLuaState() {
+		auto* lua_system = (LuaScriptSystem*)m_engine.getSystemManager().getSystem("lua_script");
+		return lua_system->getState();
+	}
+
+	void readRPCFunctionTable(Connection& c, InputMemoryStream& blob) {
+		u64 count;
+		if (!readVarint(blob, count)) return;
+		for (u64 i = 0; i < count; ++i) {
+			u64 remote_id;
+			u32 name_len;
+			if (!readVarint(blob, remote_id)) return;
+			const char* name = rpc::readString(blob, name_len);
+			if (!name) return;
+			if (remote_id >= INVALID_RPC_ID) return;
+
+			const RuntimeHash hash(name, name_len);
+			auto iter = c.rpc_remote_functions.find(hash);
+			if (iter.isValid()) iter.value() = (u32)remote_id;
+			else if (c.rpc_remote_functions.size() >= MAX_REMOTE_RPC_FUNCTIONS) {
+				logError("Too many RPC functions announced by the other side");
+				return;
+			}
+			else c.rpc_remote_functions.insert(hash, (u32)remote_id);
+
+			auto local = m_rpc_function_lookup.find(hash);
+			if (local.isValid()) resolveRemoteRPC(c, local.value());
+		}
+	}
+
+
+	// functions which were not registered with registerRPC are looked up in Network.RPCFunctions and cached
+	i32 findLegacyRPCFunction(const char* name, u32 name_len) {
+		// a truncated name would call a different function
+		if (name_len > MAX_RPC_NAME_LENGTH || memchr(name, 0, name_len)) return -1;
+		StaticString<MAX_RPC_NAME_LENGTH + 1> tmp;
+		tmp.append(StringView(name, name_len));
+		const i32 idx = findRPCFunction(tmp);
+		if (idx >= 0) return idx;
+
+		lua_State* L = getLuaState();
+		lua_getglobal(L, "Network"); // [Network]
+		lua_getfield(L, -1, "RPCFunctions"); // [Network, Network.RPCFunctions] 
+		if (!lua_istable(L, -1)) {
+			lua_pop(L, 2); // []
+			return -1;
+		}
+		lua_getfield(L, -1, tmp);  // [Network, Network.RPCFunctions, func] 
+		if (!lua_isfunction(L, -1)) {
+			lua_pop(L, 3); // []
+			return -1;
+		}
+		const u32 res = registerRPCFunction(tmp, L);
+		lua_pop(L, 3); // []
+		return res;
+	}
+
+
+	void RPC(ConnectionHandle connection, InputMemoryStream& blob)
+	{
+		Connection* conn = getConnection(connection);
+		if (!conn) return;
+
+		rpc::MessageType type;
+		if (!blob.read(&type, sizeof(type))) return;
+
+		i32 func_idx = -1;
+		switch (type) {
+			case rpc::MessageType::FUNCTION_TABLE:
+				readRPCFunctionTable(*conn, blob);
+				return;
+			case rpc::MessageType::CALL_BY_ID: {
+				u64 id;
+				if (!readVarint(blob, id)) return;
+				if (id >= (u64)m_rpc_functions.size()) {
+					logError("Unknown RPC function #", id);
+					return;
+				}
+				func_idx = (i32)id;
+				break;
+			}
+			case rpc::MessageType::CALL_BY_NAME: {
+				u32 name_len;
+				const char* name = rpc::readString(blob, name_len);
+				if (!name) return;
+				func_idx = findLegacyRPCFunction(name, name_len);
+				if (func_idx < 0) {
+					logError("Unknown RPC function ", StringView(name, name_len));
+					return;
+				}
+				break;
+			}
+			default:
+				logError("Unknown RPC message");
+				return;
+		}
+
+		if (m_is_lua_batching) {
+			LuaRPC& call = m_lua_rpcs.emplace();
+			call.func_idx = (u32)func_idx;
+			call.offset = (u32)m_lua_batch_data.size();
+			call.size = u32(blob.size() - blob.getPosition());
+			m_lua_batch_data.write(blob.getData() + blob.getPosition(), call.size);
+			return;
+		}
+
+		lua_State* L = getLuaState();
+		const RPCFunction& func = m_rpc_functions[func_idx];
+		lua_rawgeti(L, LUA_REGISTRYINDEX, func.ref); // [func]
+		const int arg_count = rpc::readArgs(blob, L); // [func, args...]
+		if (arg_count < 0) {
+			lua_pop(L, 1); // []
+			logError("Malformed arguments of RPC ", func.name);
+			return;
+		}
+		if (lua_pcall(L, arg_count, 0, 0) != LUA_OK) // []
+		{
+			logError(lua_tostring(L, -1));
+			lua_pop(L, 1);
+		}
+	}
+
+
+	void dispatchLuaEvents() {
+		lua_State* L = m_lua_callback_state;
+		const u32 count = m_lua_events.size();
+		if (m_lua_events_ref == -1) {
+			lua_createtable(L, count * 3, 0);
+			m_lua_events_ref = LuaWrapper::createRef(L);
+			lua_pop(L, 1);
+		}
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, m_lua_callback_ref); // [callback]
+		LuaWrapper::push(L, count); // [callback, count]
+		lua_rawgeti(L, LUA_REGISTRYINDEX, m_lua_events_ref); // [callback, count, events]
+		const char* data = (const char*)m_lua_batch_data.data();
+		for (u32 i = 0; i < count; ++i) {
+			const LuaEvent& e = m_lua_events[i];
+			LuaWrapper::push(L, (int)e.type);
+			lua_rawseti(L, -2, i * 3 + 1);
+			LuaWrapper::push(L, e.connection);
+			lua_rawseti(L, -2, i * 3 + 2);
+			lua_pushlstring(L, data + e.offset, e.size);
+			lua_rawseti(L, -2, i * 3 + 3);
+		}
+		// leftovers of a bigger batch, so their strings can be collected
+		for (u32 i = count * 3; i < m_lua_events_size; ++i) {
+			lua_pushnil(L);
+			lua_rawseti(L, -2, i + 1);
+		}
+		m_lua_events_size = count * 3;
+
+		if (lua_pcall(L, 2, 0, 0) != LUA_OK) { // []
+			logError(lua_tostring(L, -1));
+			lua_pop(L, 1);
+		}
+	}
+
+
+	// runs in a protected call, m_lua_rpc_next is advanced before each RPC, so after an error the next protected
+	// call continues with the following RPC
+	static int callQueuedRPCs(lua_State* L) {
+		NetSystemImpl* that = (NetSystemImpl*)lua_touserdata(L, 1);
+		lua_pop(L, 1);
+		while (that->m_lua_rpc_next < (u32)that->m_lua_rpcs.size()) {
+			const LuaRPC& call = that->m_lua_rpcs[that->m_lua_rpc_next++];
+			const RPCFunction& func = that->m_rpc_functions[call.func_idx];
+			InputMemoryStream blob(that->m_lua_batch_data.data() + call.offset, call.size);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, func.ref); // [func]
+			const int arg_count = rpc::readArgs(blob, L); // [func, args...]
+			if (arg_count < 0) {
+				lua_pop(L, 1); // []
+				logError("Malformed arguments of RPC ", func.name);
+				continue;
+			}
+			lua_call(L, arg_count, 0); // []
+		}
+		return 0;
+	}
+
+
+	// delivers what batching mode queued during `update`
+	void dispatchLuaBatch() {
+		if (!m_lua_events.empty() && m_lua_callback_ref != -1) dispatchLuaEvents();
+
+		if (!m_lua_rpcs.empty()) {
+			PROFILE_BLOCK("RPC batch");
+			lua_State* L = getLuaState();
+			m_lua_rpc_next = 0;
+			while (m_lua_rpc_next < (u32)m_lua_rpcs.size()) {
+				lua_pushcfunction(L, &callQueuedRPCs, "callQueuedRPCs");
+				lua_pushlightuserdata(L, this);
+				if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+					logError(lua_tostring(L, -1));
+					lua_pop(L, 1);
+				}
+			}
+		}
+
+		m_lua_events.clear();
+		m_lua_rpcs.clear();
+		m_lua_batch_data.clear();
+	}
+
+
+	// `shard` is the index of the server shard which produced the event or -1
+	void handleEvent(const ENetEvent& event, i32 shard)
+	{
+		switch (event.type) {
+			case ENET_EVENT_TYPE_CONNECT: {
+				// connections we initiated already have a handle
+				ConnectionHandle handle = getEventConnection(event);
+				if (handle == INVALID_CONNECTION) {
+					handle = allocConnection();
+					if (handle == INVALID_CONNECTION) {
+						logError("Too many connections.");
+						return;
+					}
+					// getConnection rejects connections without a peer
+					Connection& conn = m_connections[getIndex(handle)];
+					conn.is_server = true;
+					conn.shard = shard;
+					conn.is_batching = m_host_configs[(u32)HostType::SERVER].batch_messages;
+					conn.peer = event.peer;
+					conn.connect_id = event.connectID;
+					event.peer->data = (void*)(uintptr)handle;
+				}
+				sendRPCFunctionTable(*getConnection(handle), 0, m_rpc_functions.size());
+				callLuaCallback(event, handle);
+				if (m_connect_callback.isValid()) {
+					m_connect_callback.invoke(handle);
+				}
+				break;
+			}
+			case ENET_EVENT_TYPE_DISCONNECT: {
+				ConnectionHandle handle = getEventConnection(event);
+				if (handle == INVALID_CONNECTION) return;
+				callLuaCallback(event, handle);
+				if (m_disconnect_callback.isValid()) {
+					m_disconnect_callback.invoke(handle);
+				}
+				m_interest.removeViewer(handle);
+				dropStreams(handle);
+				// the peer can already belong to a new connection
+				if (event.peer->data == (void*)(uintptr)handle) event.peer->data = nullptr;
+				freeConnection(handle);
+				break;
+			}
+			case ENET_EVENT_TYPE_RECEIVE:
+				handleMessage(getEventConnection(event), event);
+				enet_packet_destroy(event.packet);
+				break;
+			case ENET_EVENT_TYPE_NONE: break;
+		}
+	}
+
+
+	// for batched messages `event.packet` points to the message inside of the batch
+	void handleMessage(ConnectionHandle connection, const ENetEvent& event)
+	{
+		switch ((Channel)event.channelID) {
+			case Channel::RPC: {
+				InputMemoryStream blob(event.packet->data, (int)event.packet->dataLength);
+				RPC(connection, blob);
+				break;
+			}
+			case Channel::LUA_STRING:
+				callLuaCallback(event, connection);
+				break;
+			case Channel::USER:
+				if (m_receive_callback.isValid()) {
+					Span<const u8> data(event.packet->data, event.packet->dataLength);
+					m_receive_callback.invoke(connection, data);
+				}
+				break;
+			case Channel::REPLICATION: {
+				InputMemoryStream blob(event.packet->data, (int)event.packet->dataLength);
+				handleReplication(connection, blob);
+				break;
+			}
+			case Channel::BATCH:
+				handleBatch(connection, event);
+				break;
+			case Channel::STREAM: {
+				InputMemoryStream blob(event.packet->data, (int)event.packet->dataLength);
+				handleStream(connection, blob);
+				break;
+			}
+			case Channel::COUNT:
+				ASSERT(false);
+				break;
+		}
+	}
+
+
+	void handleBatch(ConnectionHandle connection, const ENetEvent& event)
+	{
+		InputMemoryStream blob(event.packet->data, (int)event.packet->dataLength);
+		while (blob.getPosition() < blob.size()) {
+			u8 channel;
+			u64 size;
+			if (!blob.read(&channel, sizeof(channel)) || channel >= (u8)Channel::BATCH || !readVarint(blob, size) || size > blob.size() - blob.getPosition()) {
+				logError("Malformed message batch.");
+				return;
+			}
+
+			ENetPacket packet = {};
+			packet.data = event.packet->data + blob.getPosition();
+			packet.dataLength = (size_t)size;
+			ENetEvent message = event;
+			message.channelID = channel;
+			message.packet = &packet;
+			handleMessage(connection, message);
+			blob.skip(size);
+		}
+	}
+
+	void pushHostCounters(HostCounters& counters, u32 received, u32 sent) {
+		profiler::pushCounter(counters.in, (received - counters.last_received) / m_host_counters_time);
+		profiler::pushCounter(counters.out, (sent - counters.last_sent) / m_host_counters_time);
+		profiler::pushCounter(counters.total_received, received / 1024.f);
+		profiler::pushCounter(counters.total_sent, sent / 1024.f);
+		counters.last_received = received;
+		counters.last_sent = sent;
+	}
+
+	// host totals are updated by the threads servicing the hosts, read them with the threads locked,
+	// shards feed the server counters
+	void pushHostCounters() {
+		u32 received[2] = {};
+		u32 sent[2] = {};
+		if (m_thread) m_thread->m_mutex.enter();
+		const ENetHost* hosts[] = {m_server_host, m_client_host};
+		for (u32 i = 0; i < lengthOf(hosts); ++i) {
+			if (!hosts[i]) continue;
+			received[i] = hosts[i]->totalReceivedData;
+			sent[i] = hosts[i]->totalSentData;
+		}
+		if (m_thread) m_thread->m_mutex.exit();
+
+		for (NetThread* shard : m_shards) {
+			MutexGuard guard(shard->m_mutex);
+			received[(u32)HostType::SERVER] += shard->m_hosts[0]->totalReceivedData;
+			sent[(u32)HostType::SERVER] += shard->m_hosts[0]->totalSentData;
+		}
+
+		if (m_server_host || !m_shards.empty()) {
+			const u32 idx = (u32)HostType::SERVER;
+			pushHostCounters(m_host_counters[idx], received[idx], sent[idx]);
+		}
+		if (m_client_host) {
+			const u32 idx = (u32)HostType::CLIENT;
+			pushHostCounters(m_host_counters[idx], received[idx], sent[idx]);
+		}
+	}
+
+	Delegate<void (ConnectionHandle, Span<const u8>)>& onDataReceived() override { return m_receive_callback; }
+	Delegate<void(ConnectionHandle)>& onConnect() override { return m_connect_callback; }
+	Delegate<void(ConnectionHandle)>& onDisconnect() override { return m_disconnect_callback; }
+
+	void processThreadEvents(NetThread& thread, i32 shard) {
+		// handleEvent can destroy the server, which defers more events, so `e` is a copy
+		for (i32 i = 0; i < thread.m_deferred_events.size(); ++i) {
+			const ENetEvent e = thread.m_deferred_events[i];
+			handleEvent(e, shard);
+		}
+		thread.m_deferred_events.clear();
+		ENetEvent e;
+		while (thread.m_events.pop(e)) {
+			handleEvent(e, shard);
+		}
+	}
+
+	void update(float time_delta) override {
+		// scheduled messages of batching connections are flushed right away
+		updateScheduler();
+		flush();
+		if (m_batch_stats.packets > 0) {
+			profiler::pushCounter(m_batch_messages_counter, m_batch_stats.messages / (float)m_batch_stats.packets);
+			profiler::pushCounter(m_batch_saved_counter, (float)m_batch_stats.saved_bytes);
+			m_batch_stats = {};
+		}
+		m_interest.update();
+		updateStreams(time_delta);
+
+		m_host_counters_time += time_delta;
+		if (m_host_counters_time > 1) {
+			pushHostCounters();
+			m_host_counters_time = 0;
+		}
+
+		// each connection belongs to a single shard, so its events keep their order
+		for (i32 i = 0, c = m_shards.size(); i < c; ++i) {
+			processThreadEvents(*m_shards[i], i);
+		}
+
+		ENetEvent event;
+		if (m_thread) {
+			processThreadEvents(*m_thread, -1);
+		}
+		else {
+			if (m_server_host) {
+				while (enet_host_service(m_server_host, &event, 0)) {
+					handleEvent(event, -1);
+				}
+			}
+
+			if (m_client_host) {
+				while (enet_host_service(m_client_host, &event, 0)) {
+					handleEvent(event, -1);
+				}
+			}
+		}
+
+		dispatchLuaBatch();
+	}
+
+	void applyHostConfig(ENetHost* host, const HostConfig& config) {
+		const u32 flags = config.udp_segmentation ? ENET_HOST_BATCH_FLAG_SEGMENTATION : 0;
+		if (enet_host_batch_io(host, config.io_batch_size, config.io_batch_size, flags) < 0) {
+			logError("Failed to set up batched network I/O.");
+		}
+
+		// enet_host_compress destroys the previous compressor
+		switch (config.compression) {
+			case Compression::NONE: enet_host_compress(host, nullptr); break;
+			case Compression::RANGE_CODER:
+				if (enet_host_compress_with_range_coder(host) < 0) logError("Failed to set up network compression.");
+				break;
+			case Compression::LZ: {
+				ENetCompressor compressor;
+				compressor.context = LUMIX_NEW(m_allocator, LZCompressorContext)(m_allocator, config.compression_dictionary);
+				compressor.compress = &lzCompress;
+				compressor.decompress = &lzDecompress;
+				compressor.destroy = &lzDestroy;
+				enet_host_compress(host, &compressor);
+				break;
+			}
+		}
+
+		switch (config.checksum) {
+			case Checksum::NONE: host->checksum = nullptr; break;
+			case Checksum::CRC32: host->checksum = &enet_crc32; break;
+			case Checksum::CRC32C: host->checksum = &enetCRC32C; break;
+		}
+	}
+
+	void setHostConfig(HostType type, const HostConfig& config) override {
+		HostConfig& stored = m_host_configs[(u32)type];
+		stored = config;
+		OutputMemoryStream& dictionary = m_compression_dictionaries[(u32)type];
+		dictionary.clear();
+		dictionary.write(config.compression_dictionary.begin(), config.compression_dictionary.length());
+		stored.compression_dictionary = Span<const u8>((const u8*)dictionary.data(), (u32)dictionary.size());
+
+		if (type == HostType::SERVER) {
+			for (NetThread* shard : m_shards) {
+				MutexGuard guard(shard->m_mutex);
+				applyHostConfig(shard->m_hosts[0], stored);
+			}
+		}
+
+		ENetHost* host = type == HostType::SERVER ? m_server_host : m_client_host;
+		if (!host) return;
+
+		if (m_thread) {
+			MutexGuard guard(m_thread->m_mutex);
+			applyHostConfig(host, stored);
+		}
+		else {
+			applyHostConfig(host, stored);
+		}
+	}
+
+	const HostConfig& getHostConfig(HostType type) const override { return m_host_configs[(u32)type]; }
+
+	static void fillConnectionStats(const ENetPeer& peer, ConnectionStats& stats) {
+		stats.rtt = peer.roundTripTime;
+		stats.rtt_variance = peer.roundTripTimeVariance;
+		stats.packet_loss = peer.packetLoss / (float)ENET_PEER_PACKET_LOSS_SCALE;
+		stats.throttle = peer.packetThrottle / (float)ENET_PEER_PACKET_THROTTLE_SCALE;
+		stats.bytes_in = peer.totalDataReceived;
+		stats.bytes_out = peer.totalDataSent;
+		stats.packets_in = peer.totalPacketsReceived;
+		stats.packets_out = peer.totalPacketsSent;
+		stats.reliable_pending = peer.reliableCommandsPending;
+		stats.reliable_in_transit = peer.reliableDataInTransit;
+		stats.resends = peer.totalResends;
+	}
+
+	bool getConnectionStats(ConnectionHandle connection, ConnectionStats& stats) override {
+		const Connection* conn = getConnection(connection);
+		if (!conn) return false;
+
+		NetThread* thread = getThread(*conn);
+		if (thread) {
+			MutexGuard guard(thread->m_mutex);
+			fillConnectionStats(*conn->peer, stats);
+		}
+		else {
+			fillConnectionStats(*conn->peer, stats);
+		}
+		return true;
+	}
+
+	void getConnectionStats(Array<ConnectionHandle>& connections, Array<ConnectionStats>& stats) override {
+		connections.clear();
+		stats.clear();
+		// one lock per servicing thread
+		for (i32 shard = -1; shard < (i32)m_shards.size(); ++shard) {
+			NetThread* thread = shard < 0 ? m_thread : m_shards[shard];
+			if (thread) thread->m_mutex.enter();
+			for (u32 i = 0, c = m_connections.size(); i < c; ++i) {
+				const Connection& conn = m_connections[i];
+				if (!conn.peer || conn.shard != shard) continue;
+				connections.push(makeHandle(i, conn.generation));
+				fillConnectionStats(*conn.peer, stats.emplace());
+			}
+			if (thread) thread->m_mutex.exit();
+		}
+	}
+
+	void destroyServer() override {
+		if (!m_shards.empty()) {
+			destroyShards();
+			freeServerConnections();
+			return;
+		}
+		if (!m_server_host) return;
+
+		if (m_thread) {
+			MutexGuard guard(m_thread->m_mutex);
+			m_thread->removeHost(m_server_host);
+			// queued commands and events point to peers of the host
+			m_thread->processCommands();
+			ENetEvent e;
+			while (m_thread->m_events.pop(e)) {
+				if (e.peer && e.peer->host == m_server_host) {
+					if (e.packet) enet_packet_destroy(e.packet);
+				}
+				else {
+					m_thread->m_deferred_events.push(e);
+				}
+			}
+			enet_host_destroy(m_server_host);
+		}
+		else {
+			enet_host_destroy(m_server_host);
+		}
+		m_server_host = nullptr;
+		freeServerConnections();
+	}
+
+	// peers of connections accepted by the server were destroyed with its hosts
+	void freeServerConnections() {
+		for (u32 i = 0, c = m_connections.size(); i < c; ++i) {
+			Connection& conn = m_connections[i];
+			if (!conn.peer || !conn.is_server) continue;
+			const ConnectionHandle handle = makeHandle(i, conn.generation);
+			m_interest.removeViewer(handle);
+			dropStreams(handle);
+			freeConnection(handle);
+		}
+	}
+
+	void destroyShards() {
+		for (NetThread* shard : m_shards) {
+			shard->finish();
+			shard->destroy();
+			ENetEvent e;
+			while (shard->m_events.pop(e)) {
+				if (e.packet) enet_packet_destroy(e.packet);
+			}
+			enet_host_destroy(shard->m_hosts[0]);
+			LUMIX_DELETE(m_allocator, shard);
+		}
+		m_shards.clear();
+	}
+
+	bool createShardedServer(u16 port, u32 max_clients, u32 shard_count, u32 tick_rate) override {
+		if (m_server_host || !m_shards.empty()) {
+			logError("Server already exists.");
+			return false;
+		}
+		if (shard_count == 0) {
+			logError("Sharded server needs at least one shard.");
+			return false;
+		}
+
+		ENetAddress address;
+		address.port = port;
+		address.host = ENET_HOST_ANY;
+		for (u32 i = 0; i < shard_count; ++i) {
+			ENetHost* host = enet_host_create_reuse_port(&address, max_clients, (int)Channel::COUNT, 0, 0);
+			if (!host) {
+				logError("Failed to create server shard on port ", address.port, ", SO_REUSEPORT may not be supported.");
+				destroyShards();
+				return false;
+			}
+			// other shards must bind the same port if the first one got an ephemeral port
+			address.port = host->address.port;
+			applyHostConfig(host, m_host_configs[(u32)HostType::SERVER]);
+
+			NetThread* shard = LUMIX_NEW(m_allocator, NetThread)(m_allocator, maximum(tick_rate, 1u));
+			shard->addHost(host);
+			if (!shard->create("network shard", true)) {
+				logError("Failed to create network shard thread.");
+				LUMIX_DELETE(m_allocator, shard);
+				enet_host_destroy(host);
+				destroyShards();
+				return false;
+			}
+			m_shards.push(shard);
+		}
+		m_host_counters[(u32)HostType::SERVER].last_received = 0;
+		m_host_counters[(u32)HostType::SERVER].last_sent = 0;
+		return true;
+	}
+
+	bool createServer(u16 port, u32 max_clients) override {
+		if (!m_shards.empty()) {
+			logError("Sharded server already exists.");
+			return false;
+		}
+
+		ENetAddress address;
+		address.port = port;
+		address.host = ENET_HOST_ANY;
+
+		m_server_host = enet_host_create(&address, max_clients, (int)Channel::COUNT, 0, 0);
+		if (!m_server_host) return false;
+		m_host_counters[(u32)HostType::SERVER].last_received = 0;
+		m_host_counters[(u32)HostType::SERVER].last_sent = 0;
+		applyHostConfig(m_server_host, m_host_configs[(u32)HostType::SERVER]);
+
+		if (m_thread) {
+			MutexGuard guard(m_thread->m_mutex);
+			m_thread->addHost(m_server_host);
+		}
+		return true;
+	}
+
+	bool send(ConnectionHandle connection, Span<const u8> data, bool reliable) override {
+		return send(connection, (i32)Channel::USER, data.begin(), data.length(), reliable);
+	}
+
+	bool sendToRelevant(EntityRef entity, Span<const u8> data, bool reliable) override {
+		m_recipients.clear();
+		for (u32 i = 0, c = m_connections.size(); i < c; ++i) {
+			const Connection& conn = m_connections[i];
+			if (conn.peer && m_interest.isRelevant(makeHandle(i, conn.generation), entity)) m_recipients.push(i);
+		}
+		return sendShared(Span<const u32>(m_recipients.begin(), m_recipients.size()), (i32)Channel::USER, data.begin(), data.length(), reliable);
+	}
+
+	// fills m_recipients with connections of the group or all connections if `group` is null
+	void collectRecipients(const RuntimeHash* group, ConnectionHandle except) {
+		m_recipients.clear();
+		for (u32 i = 0, c = m_connections.size(); i < c; ++i) {
+			const Connection& conn = m_connections[i];
+			if (!conn.peer || makeHandle(i, conn.generation) == except) continue;
+			if (group && conn.groups.indexOf(*group) < 0) continue;
+			m_recipients.push(i);
+		}
+	}
+
+	bool broadcast(Span<const u8> data, bool reliable, ConnectionHandle except) override {
+		collectRecipients(nullptr, except);
+		return sendShared(Span<const u32>(m_recipients.begin(), m_recipients.size()), (i32)Channel::USER, data.begin(), data.length(), reliable);
+	}
+
+	bool sendToGroup(const char* group, Span<const u8> data, bool reliable, ConnectionHandle except) override {
+		const RuntimeHash hash(group);
+		collectRecipients(&hash, except);
+		return sendShared(Span<const u32>(m_recipients.begin(), m_recipients.size()), (i32)Channel::USER, data.begin(), data.length(), reliable);
+	}
+
+	bool broadcastString(const char* message, bool reliable, ConnectionHandle except) {
+		collectRecipients(nullptr, except);
+		return sendShared(Span<const u32>(m_recipients.begin(), m_recipients.size()), (i32)Channel::LUA_STRING, message, stringLength(message) + 1, reliable);
+	}
+
+	bool sendStringToGroup(const char* group, const char* message, bool reliable, ConnectionHandle except) {
+		const RuntimeHash hash(group);
+		collectRecipients(&hash, except);
+		return sendShared(Span<const u32>(m_recipients.begin(), m_recipients.size()), (i32)Channel::LUA_STRING, message, stringLength(message) + 1, reliable);
+	}
+
+	void addToGroup(const char* group, ConnectionHandle connection) override {
+		Connection* c = getConnection(connection);
+		if (!c) {
+			logError("Trying to add invalid connection to group ", group);
+			return;
+		}
+		const RuntimeHash hash(group);
+		if (c->groups.indexOf(hash) < 0) c->groups.push(hash);
+	}
+
+	void removeFromGroup(const char* group, ConnectionHandle connection) override {
+		Connection* c = getConnection(connection);
+		if (c) c->groups.eraseItem(RuntimeHash(group));
+	}
+
+	// Sends one message to connections at indices `recipients`. Recipients serviced by the same thread share one
+	// reference counted packet, like in enet_host_broadcast, so the payload is copied once per thread, not per
+	// recipient. A packet can't be shared by threads, ENet's reference counts are not atomic. Batching recipients
+	// copy the message to their batches.
+	bool sendShared(Span<const u32> recipients, int channel, const void* mem, u32 size, bool reliable) {
+		const u32 flags = reliable ? ENET_PACKET_FLAG_RELIABLE : 0;
+		bool res = true;
+		// -1 is m_thread or the game thread
+		for (i32 shard = -1; shard < (i32)m_shards.size(); ++shard) {
+			u32 count = 0;
+			for (u32 idx : recipients) {
+				Connection& c = m_connections[idx];
+				if (c.shard != shard) continue;
+				if (c.is_batching) res = batchMessage(c, channel, mem, size, reliable) && res;
+				else ++count;
+			}
+			if (count == 0) continue;
+
+			NetThread* thread = shard < 0 ? m_thread : m_shards[shard];
+			if (!thread) {
+				ENetPacket* packet = enet_packet_create(mem, size, flags);
+				if (!packet) return false;
+				for (u32 idx : recipients) {
+					const Connection& c = m_connections[idx];
+					if (c.shard != shard || c.is_batching) continue;
+					res = enet_peer_send(c.peer, channel, packet) == 0 && res;
+				}
+				if (packet->referenceCount == 0) enet_packet_destroy(packet);
+				continue;
+			}
+
+			const u32 targets_offset = getBroadcastTargetsOffset(size);
+			ENetPacket* packet = enet_packet_create(nullptr, targets_offset + count * sizeof(BroadcastTarget), flags);
+			if (!packet) return false;
+			memcpy(packet->data, mem, size);
+			packet->dataLength = size;
+			BroadcastTarget* target = (BroadcastTarget*)(packet->data + targets_offset);
+			for (u32 idx : recipients) {
+				const Connection& c = m_connections[idx];
+				if (c.shard != shard || c.is_batching) continue;
+				target->peer = c.peer;
+				target->connect_id = c.connect_id;
+				++target;
+			}
+
+			NetCommand cmd;
+			cmd.type = NetCommand::Type::BROADCAST;
+			cmd.channel = (u8)channel;
+			cmd.connect_id = 0;
+			cmd.target_count = count;
+			cmd.peer = nullptr;
+			cmd.packet = packet;
+			if (thread->m_commands.push(cmd)) {
+				thread->wake();
+			}
+			else {
+				logError("Network command queue is full.");
+				enet_packet_destroy(packet);
+				res = false;
+			}
+		}
+		return res;
+	}
+
+	bool sendString(ConnectionHandle connection, const char* message, bool reliable)
+	{
+		return send(connection, (int)Channel::LUA_STRING, message, stringLength(message) + 1, reliable);
+	}
+
+
+	bool send(ConnectionHandle connection, int channel, const void* mem, u32 size, bool reliable)
+	{
+		Connection* c = getConnection(connection);
+		if (!c)
+		{
+			logError("Trying to send data through invalid connection.");
+			return false;
+		}
+		return send(*c, channel, mem, size, reliable);
+	}
+
+
+	bool send(Connection& c, int channel, const void* mem, u32 size, bool reliable)
+	{
+		if (c.is_batching) return batchMessage(c, channel, mem, size, reliable);
+
+		ENetPacket * packet = enet_packet_create(mem, size, reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+		if (!packet) return false;
+		return send(c, channel, packet);
+	}
+
+
+	// takes ownership of `packet`
+	bool send(Connection& c, int channel, ENetPacket* packet)
+	{
+		if (NetThread* thread = getThread(c)) {
+			NetCommand cmd;
+			cmd.type = NetCommand::Type::SEND;
+			cmd.channel = (u8)channel;
+			cmd.connect_id = c.connect_id;
+			cmd.peer = c.peer;
+			cmd.packet = packet;
+			if (thread->m_commands.push(cmd)) {
+				thread->wake();
+				return true;
+			}
+			logError("Network command queue is full.");
+			enet_packet_destroy(packet);
+			return false;
+		}
+
+		if (enet_peer_send(c.peer, channel, packet) == 0) return true;
+		if (packet->referenceCount == 0) enet_packet_destroy(packet);
+		return false;
+	}
+
+
+	// takes ownership of `packet`, batched messages must go through the batch to keep their order
+	bool sendUserPacket(Connection& c, ENetPacket* packet) {
+		if (c.is_batching) {
+			const bool res = batchMessage(c, (i32)Channel::USER, packet->data, (u32)packet->dataLength, packet->flags & ENET_PACKET_FLAG_RELIABLE);
+			enet_packet_destroy(packet);
+			return res;
+		}
+		return send(c, (i32)Channel::USER, packet);
+	}
+
+
+	bool sendScheduled(ConnectionHandle connection, Span<const u8> data, float priority, u32 key, bool reliable) override {
+		Connection* c = getConnection(connection);
+		if (!c) {
+			logError("Trying to send data through invalid connection.");
+			return false;
+		}
+		if (c->send_budget == 0) return send(*c, (i32)Channel::USER, data.begin(), data.length(), reliable);
+
+		ENetPacket* packet = enet_packet_create(data.begin(), data.length(), reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+		if (!packet) return false;
+
+		if (!reliable && key != 0) {
+			for (ScheduledMessage& msg : c->scheduled) {
+				if (msg.key != key || (msg.packet->flags & ENET_PACKET_FLAG_RELIABLE)) continue;
+				c->scheduler_stats.pending_bytes -= (u32)msg.packet->dataLength;
+				c->scheduler_stats.pending_bytes += data.length();
+				++c->scheduler_stats.superseded;
+				enet_packet_destroy(msg.packet);
+				msg.packet = packet;
+				msg.priority = priority;
+				return true;
+			}
+		}
+
+		ScheduledMessage& msg = c->scheduled.emplace();
+		msg.packet = packet;
+		msg.key = key;
+		msg.priority = priority;
+		msg.accumulated = priority;
+		msg.wait = 0;
+		++c->scheduler_stats.pending_messages;
+		c->scheduler_stats.pending_bytes += data.length();
+		return true;
+	}
+
+
+	void setSendBudget(ConnectionHandle connection, u32 bytes_per_update) override {
+		Connection* c = getConnection(connection);
+		if (!c) {
+			logError("Trying to set send budget of invalid connection.");
+			return;
+		}
+		c->send_budget = bytes_per_update;
+		c->send_allowance = 0;
+		if (bytes_per_update == 0) {
+			for (const ScheduledMessage& msg : c->scheduled) sendUserPacket(*c, msg.packet);
+			c->scheduled.clear();
+			c->scheduler_stats.pending_messages = 0;
+			c->scheduler_stats.pending_bytes = 0;
+			c->scheduler_stats.max_wait = 0;
+		}
+	}
+
+
+	bool getSchedulerStats(ConnectionHandle connection, SchedulerStats& stats) override {
+		const Connection* c = getConnection(connection);
+		if (!c) return false;
+		stats = c->scheduler_stats;
+		return true;
 	}
 
-	void serialize(OutputMemoryStream& serializer) const override {}
-	bool deserialize(i32 version, InputMemoryStream& serializer) override { return version == 0; }
 
-	static int remoteCall(lua_State* L) {
-		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
-		
-		ConnectionHandle connection = LuaWrapper::checkArg<ConnectionHandle>(L, 1);
-		bool is_connection_valid = connection >= 0 && connection < that->m_connections.size();
-		if (!is_connection_valid) luaL_argerror(L, 1, "invalid connection");
-		const char* func_name = LuaWrapper::checkArg<const char*>(L, 2);
-		int func_arg_count = lua_gettop(L) - 2;
-
-		char buf[1024];
-		// TODO handle overflow in blob
-		OutputMemoryStream blob(buf, sizeof(buf));
-		blob.writeString(func_name);
-		blob.write(func_arg_count);
-
-		for (int i = 0; i < func_arg_count; ++i) {
-			int type = lua_type(L, i + 3);
-			switch (type) {
-				case LUA_TSTRING:
-					blob.write(type);
-					blob.writeString(lua_tostring(L, i + 3));
-					break;
-				case LUA_TNUMBER:
-					blob.write(type);
-					blob.write(lua_tonumber(L, i + 3));
-					break;
-				case LUA_TBOOLEAN:
-					blob.write(type);
-					blob.write(lua_toboolean(L, i + 3) != 0);
-					break;
-				default: logError("Can not RPC ", func_name, ", #", i + 1, "argument's type is not supported"); return 0;
+	// Sends pending messages with the highest priority while the connection has budget. A message can overdraw
+	// the budget, so messages bigger than the budget are sent too, the debt is paid by the next updates.
+	void updateScheduler() {
+		PROFILE_FUNCTION();
+		for (Connection& c : m_connections) {
+			if (!c.peer || c.send_budget == 0) continue;
+
+			c.send_allowance = minimum(c.send_allowance + (i32)c.send_budget, (i32)c.send_budget);
+			// stable insertion sort, priorities mostly keep their order between updates, so it's close to linear;
+			// messages of the same priority and age keep their order
+			Array<ScheduledMessage>& scheduled = c.scheduled;
+			for (i32 i = 1, n = scheduled.size(); i < n; ++i) {
+				const ScheduledMessage msg = scheduled[i];
+				i32 j = i;
+				for (; j > 0 && scheduled[j - 1].accumulated < msg.accumulated; --j) scheduled[j] = scheduled[j - 1];
+				scheduled[j] = msg;
 			}
-		}
 
-		that->send(connection, (int)Channel::RPC, buf, (u32)blob.size(), true);
-		return 0;
+			SchedulerStats& stats = c.scheduler_stats;
+			stats.sent_messages = 0;
+			stats.sent_bytes = 0;
+			u32 sent = 0;
+			for (; sent < (u32)scheduled.size() && c.send_allowance > 0; ++sent) {
+				ENetPacket* packet = scheduled[sent].packet;
+				const u32 size = (u32)packet->dataLength;
+				c.send_allowance -= (i32)size;
+				++stats.sent_messages;
+				stats.sent_bytes += size;
+				stats.pending_bytes -= size;
+				sendUserPacket(c, packet);
+			}
+			for (u32 i = sent, n = scheduled.size(); i < n; ++i) scheduled[i - sent] = scheduled[i];
+			for (u32 i = 0; i < sent; ++i) scheduled.pop();
+
+			stats.pending_messages = scheduled.size();
+			stats.max_wait = 0;
+			for (ScheduledMessage& msg : scheduled) {
+				msg.accumulated += msg.priority;
+				++msg.wait;
+				stats.max_wait = maximum(stats.max_wait, msg.wait);
+			}
+		}
 	}
 
 
-	static int setCallback(lua_State* L) {
-		NetSystemImpl* that = LuaWrapper::toType<NetSystemImpl*>(L, lua_upvalueindex(1));
+	Replication& getReplication() override { return m_replication; }
+	Interest& getInterest() override { return m_interest; }
 
-		if (!lua_isfunction(L, 1)) LuaWrapper::argError(L, 1, "function");
 
-		if (that->m_lua_callback_ref != -1) {
-			LuaWrapper::releaseRef(that->m_lua_callback_state, that->m_lua_callback_ref);
+	void replicate() override {
+		PROFILE_FUNCTION();
+		m_interest.update();
+		m_replication.captureSnapshot();
+		for (u32 i = 0, count = m_connections.size(); i < count; ++i) {
+			Connection& c = m_connections[i];
+			if (!c.peer || !c.is_server) continue;
+
+			const bool is_filtered = m_interest.getRelevantEntities(makeHandle(i, c.generation), m_relevant_entities);
+			m_replication_blob.clear();
+			m_replication.writeDelta(c.replication_client, c.replication_ack, is_filtered ? &m_relevant_entities : nullptr, m_replication_blob);
+			// big snapshots must not turn into reliable fragments, a lost delta is superseded by the next one
+			ENetPacket* packet = enet_packet_create(m_replication_blob.data(), m_replication_blob.size(), ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT);
+			if (packet) send(c, (int)Channel::REPLICATION, packet);
 		}
+	}
 
-		that->m_lua_callback_state = L;
-		lua_pushvalue(L, 1);
-		that->m_lua_callback_ref = LuaWrapper::createRef(L);
-		lua_pop(L, 1);
-		return 0;
+
+	// servers receive acknowledged ticks, clients receive deltas
+	void handleReplication(ConnectionHandle connection, InputMemoryStream& blob) {
+		Connection* c = getConnection(connection);
+		if (!c) return;
+
+		if (c->is_server) {
+			u64 tick;
+			if (!readVarint(blob, tick)) return;
+			// acks can arrive out of order
+			if (tick > c->replication_ack && tick <= m_replication.getTick()) c->replication_ack = (u32)tick;
+			return;
+		}
+
+		u32 tick;
+		if (!m_replication.readDelta(blob, tick)) return;
+		m_replication_blob.clear();
+		writeVarint(m_replication_blob, tick);
+		send(*c, (int)Channel::REPLICATION, m_replication_blob.data(), (u32)m_replication_blob.size(), false);
 	}
 
 
-	void registerLuaAPI(lua_State* L)
+	bool batchMessage(Connection& c, int channel, const void* mem, u32 size, bool reliable)
 	{
-		#define REGISTER_FUNCTION(name) \
-			do {\
-				auto f = &LuaWrapper::wrapMethodClosure<&NetSystemImpl::name>; \
-				LuaWrapper::createSystemClosure(L, "Network", this, #name, f); \
-			} while(false) \
-
-			LuaWrapper::createSystemClosure(L, "Network", this, "setCallback", &NetSystemImpl::setCallback);
-			LuaWrapper::createSystemClosure(L, "Network", this, "call", &NetSystemImpl::remoteCall);
-			REGISTER_FUNCTION(createServer);
-			REGISTER_FUNCTION(connect);
-			REGISTER_FUNCTION(sendString);
-			REGISTER_FUNCTION(eventPacketToString);
-			REGISTER_FUNCTION(disconnect); 
+		Batch& batch = c.batch;
+		// channel and varint size take at most 6 bytes
+		if (batch.messages > 0 && (batch.reliable != reliable || batch.data.size() + size + 6 > MAX_BATCH_SIZE)) {
+			if (!flushBatch(c)) return false;
+		}
 
-		#undef REGISTER_FUNCTION
+		batch.reliable = reliable;
+		const u64 start = batch.data.size();
+		batch.data.write((u8)channel);
+		writeVarint(batch.data, size);
+		batch.prefix_bytes += u32(batch.data.size() - start);
+		batch.data.write(mem, size);
+		++batch.messages;
+		// big messages go right away, as a batch of one, so they keep their order
+		if (batch.data.size() >= MAX_BATCH_SIZE) return flushBatch(c);
+		return true;
 	}
 
-	
-	~NetSystemImpl() override
+
+	bool flushBatch(Connection& c)
 	{
-		if (!m_is_initialized) return;
+		Batch& batch = c.batch;
+		if (batch.messages == 0) return true;
+
+		const bool reliable = batch.reliable;
+		// without batching every message would have its own ENet command
+		const i64 command_size = reliable ? sizeof(ENetProtocolSendReliable) : sizeof(ENetProtocolSendUnreliable);
+		m_batch_stats.messages += batch.messages;
+		++m_batch_stats.packets;
+		m_batch_stats.saved_bytes += (batch.messages - 1) * command_size - batch.prefix_bytes;
+
+		ENetPacket* packet = enet_packet_create(batch.data.data(), batch.data.size(), reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+		batch.data.clear();
+		batch.messages = 0;
+		batch.prefix_bytes = 0;
+		if (!packet) return false;
+		return send(c, (int)Channel::BATCH, packet);
+	}
 
-		for(Connection& c : m_connections)
-		{
-			if (!c.peer) continue;
-			enet_peer_reset(c.peer);
+
+	void flush() override {
+		for (Connection& c : m_connections) {
+			if (!c.peer || !c.is_batching) continue;
+			flushBatch(c);
 		}
+	}
 
-		if (m_server_host) enet_host_destroy(m_server_host);
-		if (m_client_host) enet_host_destroy(m_client_host);
 
-		enet_deinitialize();
+	void setBatching(ConnectionHandle connection, bool enabled) override {
+		Connection* c = getConnection(connection);
+		if (!c) {
+			logError("Trying to set batching of invalid connection.");
+			return;
+		}
+		if (c->is_batching && !enabled) flushBatch(*c);
+		c->is_batching = enabled;
 	}
 
 
-	const char* eventPacketToString(ENetEvent* event)
-	{
-		if (!event->packet) return "";
-		if (event->packet->dataLength == 0) return "";
-		if (event->packet->data[event->packet->dataLength - 1] != '\0') return "";
-		return (const char*)event->packet->data;
+	static void ENET_CALLBACK freePooledPacket(ENetPacket* packet) {
+		PacketPool* pool = (PacketPool*)packet->userData;
+		pool->deallocate(packet->data);
 	}
 
 
-	void callLuaCallback(const ENetEvent& event, ConnectionHandle connection)
-	{
-		if (m_lua_callback_ref == -1) return;
-
-		lua_rawgeti(m_lua_callback_state, LUA_REGISTRYINDEX, m_lua_callback_ref);
+	Packet reservePacket(u32 capacity) override {
+		Packet res;
+		void* mem = m_packet_pool.allocate(capacity);
+		if (!mem) return res;
 
-		LuaWrapper::push(m_lua_callback_state, (int)event.type);
-		LuaWrapper::push(m_lua_callback_state, connection);
-		LuaWrapper::push(m_lua_callback_state, &event);
-		if (lua_pcall(m_lua_callback_state, 3, 0, 0) != LUA_OK)
-		{
-			logError(lua_tostring(m_lua_callback_state, -1));
-			lua_pop(m_lua_callback_state, 1);
+		ENetPacket* packet = enet_packet_create(mem, capacity, ENET_PACKET_FLAG_NO_ALLOCATE);
+		if (!packet) {
+			m_packet_pool.deallocate(mem);
+			return res;
 		}
+		packet->freeCallback = &freePooledPacket;
+		packet->userData = &m_packet_pool;
+
+		res.data = (u8*)mem;
+		res.capacity = capacity;
+		res.handle = packet;
+		return res;
 	}
 
 
-	int getConnection(const ENetPeer* peer) const
-	{
-		if (!peer) return -1;
-		for (int i = 0, c = m_connections.size(); i < c; ++i)
+	bool sendPacket(ConnectionHandle connection, Packet& packet, bool reliable) override {
+		ENetPacket* enet_packet = (ENetPacket*)packet.handle;
+		ASSERT(enet_packet);
+		ASSERT(packet.size <= packet.capacity);
+		const u32 size = packet.size;
+		packet = {};
+
+		Connection* c = getConnection(connection);
+		if (!c)
 		{
-			const Connection& conn = m_connections[i];
-			if (conn.peer == peer) return i;
+			logError("Trying to send data through invalid connection.");
+			enet_packet_destroy(enet_packet);
+			return false;
 		}
-		return -1;
+
+		enet_packet->dataLength = size;
+		if (reliable) enet_packet->flags |= ENET_PACKET_FLAG_RELIABLE;
+		return sendUserPacket(*c, enet_packet);
 	}
 
-	lua_State* getLuaState() {
-		auto* lua_system = (LuaScriptSystem*)m_engine.getSystemManager().getSystem("lua_script");
-		return lua_system->getState();
+
+	void releasePacket(Packet& packet) override {
+		if (packet.handle) enet_packet_destroy((ENetPacket*)packet.handle);
+		packet = {};
 	}
 
-	void RPC(InputMemoryStream* blob)
+
+	ConnectionHandle allocConnection()
 	{
-		const char* func_name = blob->readString();
-		lua_State* L = getLuaState();
-		lua_getglobal(L, "Network"); // [Network]
-		lua_getfield(L, -1, "RPCFunctions"); // [Network, Network.RPCFunctions] 
-		if (!lua_istable(L, -1))
-		{
-			lua_pop(L, 2); // []
-			logError("Unknown RPC function", func_name);
-			return;
-		}
-		lua_getfield(L, -1, func_name);  // [Network, Network.RPCFunctions, func] 
-		if(!lua_isfunction(L, -1))
-		{ 
-			lua_pop(L, 3); // []
-			logError("Unknown RPC function", func_name);
-			return;
+		if (m_first_free_connection >= 0) {
+			const u32 idx = (u32)m_first_free_connection;
+			Connection& c = m_connections[idx];
+			m_first_free_connection = c.next_free;
+			c.next_free = -1;
+			return makeHandle(idx, c.generation);
 		}
 
-		int func_arg_count = blob->read<int>();
-		for (int i = 0; i < func_arg_count; ++i)
-		{
-			int type = blob->read<int>();
-			switch(type)
-			{
-				case LUA_TSTRING:
-				{
-					const char* tmp = blob->readString();
-					lua_pushstring(L, tmp); // [Network, Network.RPCFunctions, func, args...] 
-					break;
-				}
-				case LUA_TNUMBER:
-				{
-					lua_Number n = blob->read<lua_Number>();
-					lua_pushnumber(L, n);
-					break;
-				}
-				case LUA_TBOOLEAN:
-				{
-					bool b = blob->read<bool>();
-					lua_pushboolean(L, b ? 1 : 0);
-					break;
-				}
-				default:
-					lua_pop(L, 3 + i);
-					logError(func_name, ": type of argument #", i + 1, " not supported by RPC");
-					return;
-			}
-		}
-		if (lua_pcall(L, func_arg_count, 0, 0) != LUA_OK)// [Network, Network.RPCFunctions] 
-		{
-			logError(lua_tostring(L, -1));
-			lua_pop(L, 1);
-		}
-		lua_pop(L, 2); // []
+		if (m_connections.size() > 0xffFF) return INVALID_CONNECTION;
+		m_connections.emplace(m_allocator);
+		return makeHandle(m_connections.size() - 1, m_connections.last().generation);
 	}
 
 
-	void handleEvent(const ENetEvent& event)
+	void freeConnection(ConnectionHandle handle)
 	{
-		switch (event.type) {
-			case ENET_EVENT_TYPE_CONNECT: {
-				ConnectionHandle idx = allocConnection();
-				Connection& conn = m_connections[idx];
-				conn.is_server = true;
-				conn.peer = event.peer;
-				callLuaCallback(event, getConnection(event.peer));
-				if (m_connect_callback.isValid()) {
-					m_connect_callback.invoke(idx);
-				}
-				break;
-			}
-			case ENET_EVENT_TYPE_DISCONNECT: {
-				ConnectionHandle idx = getConnection(event.peer);
-				if (idx < 0) return;
-				m_connections[idx].peer = nullptr;
-				callLuaCallback(event, getConnection(event.peer));
-				if (m_disconnect_callback.isValid()) {
-					m_disconnect_callback.invoke(idx);
-				}
-				break;
-			}
-			case ENET_EVENT_TYPE_RECEIVE:
-				switch ((Channel)event.channelID) {
-					case Channel::RPC: {
-						InputMemoryStream blob(event.packet->data, (int)event.packet->dataLength);
-						RPC(&blob);
-						break;
-					}
-					case Channel::LUA_STRING:
-						callLuaCallback(event, getConnection(event.peer));
-						break;
-					case Channel::USER:
-						if (m_receive_callback.isValid()) {
-							ConnectionHandle conn = getConnection(event.peer);
-							Span<const u8> data(event.packet->data, event.packet->dataLength);
-							m_receive_callback.invoke(conn, data);
-						}
-						break;
-					case Channel::COUNT:
-						ASSERT(false);
-						break;
-				}
-				break;
-			case ENET_EVENT_TYPE_NONE: break;
-		}
+		const u32 idx = getIndex(handle);
+		Connection& c = m_connections[idx];
+		c.peer = nullptr;
+		c.connect_id = 0;
+		c.shard = -1;
+		c.rpc_remote_functions.clear();
+		c.rpc_remote_ids.clear();
+		c.replication_ack = 0;
+		c.replication_client.reset();
+		// the history is shared with the server role, keep it if this is a server too
+		if (!c.is_server && !m_server_host && m_shards.empty()) m_replication.resetClient();
+		c.is_batching = false;
+		c.stream_in_flight = 0;
+		for (const ScheduledMessage& msg : c.scheduled) enet_packet_destroy(msg.packet);
+		c.scheduled.clear();
+		c.send_budget = 0;
+		c.send_allowance = 0;
+		c.scheduler_stats = {};
+		c.groups.clear();
+		c.batch.data.clear();
+		c.batch.messages = 0;
+		c.batch.prefix_bytes = 0;
+		// generation 0 is never used, so handles are never 0
+		c.generation = c.generation == 0x7fFF ? 1 : c.generation + 1;
+		c.next_free = m_first_free_connection;
+		m_first_free_connection = (i32)idx;
 	}
 
-	Delegate<void (ConnectionHandle, Span<const u8>)>& onDataReceived() override { return m_receive_callback; }
-	Delegate<void(ConnectionHandle)>& onConnect() override { return m_connect_callback; }
-	Delegate<void(ConnectionHandle)>& onDisconnect() override { return m_disconnect_callback; }
 
-	void update(float time_delta) override {
-		static u32 bw_in_counter = profiler::createCounter("Net in (B/s)", 0);
-		static u32 bw_out_counter = profiler::createCounter("Net out (B/s)", 0);
-		static u32 total_send_counter = profiler::createCounter("Net total send (KB)", 0);
-		static u32 total_recv_counter = profiler::createCounter("Net total recv (KB)", 0);
-		ENetEvent event;
+	ConnectionHandle connect(const char* host_name, u16 port) override {
+		ENetAddress address;
+		enet_address_set_host(&address, host_name);
+		address.port = port;
 
-		static float timer = 0;
-		timer += time_delta;
-		if (timer > 1) {
-			ENetHost* host = m_server_host ? m_server_host : m_client_host;
-			if (host) {
-				static u32 total_send = host->totalSentData;
-				static u32 total_recv = host->totalReceivedData;
-				float out = (host->totalSentData - total_send) / timer;
-				float in = (host->totalReceivedData - total_recv) / timer;
-				profiler::pushCounter(bw_in_counter, out);
-				profiler::pushCounter(bw_out_counter, in);
-				total_send = host->totalSentData;
-				total_recv = host->totalReceivedData;
+		if (m_thread) m_thread->m_mutex.enter();
+		if (!m_client_host) {
+			m_client_host = enet_host_create(nullptr, 64, (int)Channel::COUNT, 0, 0);
+			if (!m_client_host) {
+				if (m_thread) m_thread->m_mutex.exit();
+				return INVALID_CONNECTION;
 			}
-			timer = 0;
+			m_host_counters[(u32)HostType::CLIENT].last_received = 0;
+			m_host_counters[(u32)HostType::CLIENT].last_sent = 0;
+			applyHostConfig(m_client_host, m_host_configs[(u32)HostType::CLIENT]);
+			if (m_thread) m_thread->addHost(m_client_host);
 		}
 
-
-		if (m_server_host) {
-			profiler::pushCounter(total_send_counter, m_server_host->totalSentData / 1024.f);
-			profiler::pushCounter(total_recv_counter, m_server_host->totalReceivedData / 1024.f);
-
-			while (enet_host_service(m_server_host, &event, 0)) {
-				handleEvent(event);
+		ConnectionHandle handle = INVALID_CONNECTION;
+		ENetPeer* peer = enet_host_connect(m_client_host, &address, (int)Channel::COUNT, 0);
+		if (peer) {
+			handle = allocConnection();
+			if (handle != INVALID_CONNECTION) {
+				Connection& conn = m_connections[getIndex(handle)];
+				conn.peer = peer;
+				conn.connect_id = peer->connectID;
+				conn.is_server = false;
+				conn.is_batching = m_host_configs[(u32)HostType::CLIENT].batch_messages;
+				peer->data = (void*)(uintptr)handle;
 			}
+			else {
+				logError("Too many connections.");
+				enet_peer_reset(peer);
+			}
+		}
+		if (m_thread) {
+			m_thread->m_mutex.exit();
+			// the handshake goes out right away, not with the next tick
+			if (handle != INVALID_CONNECTION) m_thread->wake();
 		}
 
-		if (m_client_host) {
-			profiler::pushCounter(total_send_counter, m_client_host->totalSentData / 1024.f);
-			profiler::pushCounter(total_recv_counter, m_client_host->totalReceivedData / 1024.f);
+		return handle;
+	}
 
-			while (enet_host_service(m_client_host, &event, 0)) {
-				handleEvent(event);
-			}
+	void disconnect(ConnectionHandle handle) override {
+		const Connection* c = getConnection(handle);
+		if (!c) {
+			logError("Trying to close invalid connection.");
+			return;
+		}
+
+		if (NetThread* thread = getThread(*c)) {
+			NetCommand cmd;
+			cmd.type = NetCommand::Type::DISCONNECT;
+			cmd.connect_id = c->connect_id;
+			cmd.peer = c->peer;
+			cmd.packet = nullptr;
+			if (thread->m_commands.push(cmd)) thread->wake();
+			else logError("Network command queue is full.");
+			return;
 		}
+		enet_peer_disconnect(c->peer, 0);
 	}
 
-	void destroyServer() override {
-		if (m_server_host) enet_host_destroy(m_server_host);
-		m_server_host = nullptr;
+	// stream messages bypass batching, DATA is sent directly and all messages of a stream must keep their order
+	bool sendStreamBlob(Connection& c) {
+		ENetPacket* packet = enet_packet_create(m_stream_blob.data(), m_stream_blob.size(), ENET_PACKET_FLAG_RELIABLE);
+		return packet && send(c, (i32)Channel::STREAM, packet);
 	}
 
-	bool createServer(u16 port, u32 max_clients) override {
-		ENetAddress address;
-		address.port = port;
-		address.host = ENET_HOST_ANY;
+	bool sendStreamMessage(Connection& c, StreamMessage type, u32 id) {
+		m_stream_blob.clear();
+		m_stream_blob.write(type);
+		writeVarint(m_stream_blob, id);
+		return sendStreamBlob(c);
+	}
 
-		m_server_host = enet_host_create(&address, max_clients, (int)Channel::COUNT, 0, 0);
-		if (!m_server_host) return false;
+	void sendStreamAck(Connection& c, IncomingStream& s) {
+		m_stream_blob.clear();
+		m_stream_blob.write(StreamMessage::ACK);
+		writeVarint(m_stream_blob, s.id);
+		writeVarint(m_stream_blob, s.received);
+		sendStreamBlob(c);
+		s.acked = s.received;
+	}
 
-		return true;
+	i32 findOutgoingStream(ConnectionHandle connection, StreamHandle handle) const {
+		for (i32 i = 0, c = m_outgoing_streams.size(); i < c; ++i) {
+			const OutgoingStream* s = m_outgoing_streams[i];
+			if (s->handle == handle && (connection == INVALID_CONNECTION || s->connection == connection)) return i;
+		}
+		return -1;
 	}
 
-	bool send(ConnectionHandle connection, Span<const u8> data, bool reliable) override {
-		return send(connection, (i32)Channel::USER, data.begin(), data.length(), reliable);
+	i32 findIncomingStream(ConnectionHandle connection, u32 id) const {
+		for (i32 i = 0, c = m_incoming_streams.size(); i < c; ++i) {
+			const IncomingStream& s = m_incoming_streams[i];
+			if (s.id == id && s.connection == connection) return i;
+		}
+		return -1;
 	}
 
-	bool sendString(ConnectionHandle connection, const char* message, bool reliable)
-	{
-		return send(connection, (int)Channel::LUA_STRING, message, stringLength(message) + 1, reliable);
+	// removes the stream before the callback, so the callback can start or cancel streams
+	void finishOutgoingStream(i32 idx, bool completed, bool notify) {
+		OutgoingStream* s = m_outgoing_streams[idx];
+		m_outgoing_streams.erase(idx);
+		if (Connection* c = getConnection(s->connection)) c->stream_in_flight -= u32(s->sent - s->acked);
+		const StreamHandle handle = s->handle;
+		LUMIX_DELETE(m_allocator, s);
+		if (notify && m_stream_sent_callback.isValid()) m_stream_sent_callback.invoke(handle, completed);
 	}
 
+	void finishIncomingStream(i32 idx, StreamEvent::Type type) {
+		StreamEvent e;
+		e.type = type;
+		e.connection = m_incoming_streams[idx].connection;
+		e.stream = m_incoming_streams[idx].id;
+		e.offset = m_incoming_streams[idx].received;
+		e.size = m_incoming_streams[idx].end;
+		m_incoming_streams.erase(idx);
+		if (m_stream_received_callback.isValid()) m_stream_received_callback.invoke(e);
+	}
 
-	bool send(ConnectionHandle connection, int channel, const void* mem, u32 size, bool reliable)
-	{
-		if (connection >= m_connections.size() || !m_connections[connection].peer)
-		{
-			logError("Trying to send data through invalid connection.");
-			return false;
+	void rejectIncomingStream(Connection& c, i32 idx) {
+		sendStreamMessage(c, StreamMessage::REJECT, m_incoming_streams[idx].id);
+		finishIncomingStream(idx, StreamEvent::Type::CANCELED);
+	}
+
+	// streams of a closing connection
+	void dropStreams(ConnectionHandle connection) {
+		for (i32 i = m_outgoing_streams.size() - 1; i >= 0; --i) {
+			if (i < m_outgoing_streams.size() && m_outgoing_streams[i]->connection == connection) finishOutgoingStream(i, false, true);
 		}
-		ENetPacket * packet = enet_packet_create(mem, size, reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
-		Connection& c = m_connections[connection];
-		return enet_peer_send(c.peer, channel, packet) == 0;
+		cancelIncomingStreams(connection);
 	}
 
+	void cancelIncomingStreams(ConnectionHandle connection) {
+		for (i32 i = m_incoming_streams.size() - 1; i >= 0; --i) {
+			if (i < m_incoming_streams.size() && m_incoming_streams[i].connection == connection) finishIncomingStream(i, StreamEvent::Type::CANCELED);
+		}
+	}
 
-	int allocConnection()
-	{
-		for (int i = 0; i < m_connections.size(); ++i)
-		{
-			Connection& c = m_connections[i];
-			if (!c.peer) return i;
+	// takes ownership of `s`
+	StreamHandle startStream(OutgoingStream* s, ConnectionHandle connection, const char* name, u64 offset, u64 end) {
+		Connection* c = getConnection(connection);
+		const u32 name_len = stringLength(name);
+		if (!c || name_len >= MAX_PATH) {
+			logError(c ? "Stream name is too long." : "Trying to stream through invalid connection.");
+			LUMIX_DELETE(m_allocator, s);
+			return INVALID_STREAM;
 		}
 
-		m_connections.emplace();
-		return m_connections.size() - 1;
+		m_next_stream = m_next_stream == 0xffFFffFF ? 1 : m_next_stream + 1;
+		s->handle = m_next_stream;
+		s->connection = connection;
+		s->sent = s->acked = offset;
+		s->end = end;
+
+		m_stream_blob.clear();
+		m_stream_blob.write(StreamMessage::BEGIN);
+		writeVarint(m_stream_blob, s->handle);
+		writeVarint(m_stream_blob, offset);
+		writeVarint(m_stream_blob, end);
+		rpc::writeString(m_stream_blob, name, name_len);
+		if (!sendStreamBlob(*c)) {
+			LUMIX_DELETE(m_allocator, s);
+			return INVALID_STREAM;
+		}
+		// otherwise END follows the last chunk
+		if (offset == end) sendStreamMessage(*c, StreamMessage::END, s->handle);
+		m_outgoing_streams.push(s);
+		return s->handle;
 	}
 
+	StreamHandle sendStream(ConnectionHandle connection, const char* name, IInputStream& stream, u64 offset, u64 size) override {
+		OutgoingStream* s = LUMIX_NEW(m_allocator, OutgoingStream);
+		s->input = &stream;
+		return startStream(s, connection, name, offset, offset + size);
+	}
 
-	ConnectionHandle connect(const char* host_name, u16 port) override {
-		if (!m_client_host) {
-			m_client_host = enet_host_create(nullptr, 64, (int)Channel::COUNT, 0, 0);
-			if (!m_client_host) return INVALID_CONNECTION;
+	StreamHandle sendFile(ConnectionHandle connection, const char* name, const char* path, u64 offset) override {
+		OutgoingStream* s = LUMIX_NEW(m_allocator, OutgoingStream);
+		if (!s->file.open(path)) {
+			logError("Failed to open ", path);
+			LUMIX_DELETE(m_allocator, s);
+			return INVALID_STREAM;
 		}
+		s->is_file = true;
+		s->input = &s->file;
+		const u64 size = s->file.size();
+		if (offset > size || !s->file.seek(offset)) {
+			logError("Failed to seek to ", offset, " in ", path);
+			LUMIX_DELETE(m_allocator, s);
+			return INVALID_STREAM;
+		}
+		return startStream(s, connection, name, offset, size);
+	}
 
-		int idx = allocConnection();
-		Connection& conn = m_connections[idx];
+	void cancelStream(StreamHandle stream) override {
+		const i32 idx = findOutgoingStream(INVALID_CONNECTION, stream);
+		if (idx < 0) return;
+		if (Connection* c = getConnection(m_outgoing_streams[idx]->connection)) sendStreamMessage(*c, StreamMessage::CANCEL, stream);
+		finishOutgoingStream(idx, false, false);
+	}
 
-		ENetAddress address;
-		enet_address_set_host(&address, host_name);
-		address.port = port;
-		conn.peer = enet_host_connect(m_client_host, &address, (int)Channel::COUNT, 0);
-		conn.is_server = false;
+	void cancelIncomingStream(ConnectionHandle connection, u32 stream) override {
+		const i32 idx = findIncomingStream(connection, stream);
+		if (idx < 0) return;
+		if (Connection* c = getConnection(connection)) sendStreamMessage(*c, StreamMessage::REJECT, stream);
+		m_incoming_streams.erase(idx);
+	}
+
+	void setStreamBandwidth(u32 bytes_per_second) override {
+		m_stream_bandwidth = bytes_per_second;
+		m_stream_budget = 0;
+	}
+	Delegate<void (const StreamEvent&)>& onStreamReceived() override { return m_stream_received_callback; }
+	Delegate<void (StreamHandle, bool)>& onStreamSent() override { return m_stream_sent_callback; }
+
+	// reads the chunk straight into the packet, returns its size, 0 if the stream waits for acknowledgements, -1 on failure,
+	// -2 if nothing can be sent to the connection anymore, not even CANCEL
+	i32 sendStreamChunk(OutgoingStream& s) {
+		Connection* c = getConnection(s.connection);
+		if (!c) return -1;
+		if (s.sent == s.end || c->stream_in_flight >= STREAM_WINDOW) return 0;
+
+		const u32 size = (u32)minimum(u64(STREAM_CHUNK_SIZE), s.end - s.sent);
+		m_stream_blob.clear();
+		m_stream_blob.write(StreamMessage::DATA);
+		writeVarint(m_stream_blob, s.handle);
+		writeVarint(m_stream_blob, s.sent);
+		const u32 header_size = (u32)m_stream_blob.size();
+		ENetPacket* packet = enet_packet_create(nullptr, header_size + size, ENET_PACKET_FLAG_RELIABLE);
+		if (!packet) {
+			logError("Failed to allocate chunk of stream ", s.handle);
+			sendStreamMessage(*c, StreamMessage::CANCEL, s.handle);
+			return -1;
+		}
+		memcpy(packet->data, m_stream_blob.data(), header_size);
+		if (!s.input->read(packet->data + header_size, size)) {
+			logError("Failed to read stream ", s.handle);
+			enet_packet_destroy(packet);
+			sendStreamMessage(*c, StreamMessage::CANCEL, s.handle);
+			return -1;
+		}
+		if (!send(*c, (i32)Channel::STREAM, packet)) {
+			return sendStreamMessage(*c, StreamMessage::CANCEL, s.handle) ? -1 : -2;
+		}
 
-		return conn.peer ? idx : INVALID_CONNECTION;
+		s.sent += size;
+		c->stream_in_flight += size;
+		if (s.sent == s.end) sendStreamMessage(*c, StreamMessage::END, s.handle);
+		return (i32)size;
 	}
 
-	void disconnect(ConnectionHandle idx) override {
-		if (idx >= m_connections.size() || !m_connections[idx].peer) {
-			logError("Trying to close invalid connection.");
+	// a chunk of each stream per round, so the streams share the budget
+	void updateStreams(float time_delta) {
+		if (m_outgoing_streams.empty()) return;
+		PROFILE_FUNCTION();
+
+		const bool is_limited = m_stream_bandwidth > 0;
+		if (is_limited) m_stream_budget = minimum(m_stream_budget + m_stream_bandwidth * time_delta, m_stream_bandwidth * STREAM_MAX_BURST);
+		bool is_sending = true;
+		while (is_sending) {
+			is_sending = false;
+			for (i32 i = 0; i < m_outgoing_streams.size(); ) {
+				if (is_limited && m_stream_budget <= 0) return;
+				const i32 size = sendStreamChunk(*m_outgoing_streams[i]);
+				if (size < 0) {
+					const ConnectionHandle connection = m_outgoing_streams[i]->connection;
+					finishOutgoingStream(i, false, true);
+					// the peer's disconnect cancels its side, streams it sends to us would never finish
+					if (size == -2) cancelIncomingStreams(connection);
+					continue;
+				}
+				if (size > 0) {
+					if (is_limited) m_stream_budget -= size;
+					is_sending = true;
+				}
+				++i;
+			}
+		}
+	}
+
+	void handleStream(ConnectionHandle connection, InputMemoryStream& blob) {
+		Connection* c = getConnection(connection);
+		if (!c) return;
+
+		StreamMessage type;
+		u64 id;
+		if (!blob.read(&type, sizeof(type)) || !readVarint(blob, id) || id > 0xffFFffFF) {
+			logError("Malformed stream message.");
 			return;
 		}
-		enet_peer_disconnect(m_connections[idx].peer, 0);
+
+		switch (type) {
+			case StreamMessage::BEGIN: {
+				u64 offset, size;
+				u32 name_len;
+				const char* name = nullptr;
+				if (readVarint(blob, offset) && readVarint(blob, size) && offset <= size) name = rpc::readString(blob, name_len);
+				if (!name || name_len >= MAX_PATH || findIncomingStream(connection, (u32)id) >= 0) {
+					logError("Malformed stream message.");
+					return;
+				}
+
+				IncomingStream& s = m_incoming_streams.emplace();
+				s.connection = connection;
+				s.id = (u32)id;
+				s.received = s.acked = offset;
+				s.end = size;
+
+				StaticString<MAX_PATH> tmp;
+				tmp.append(StringView(name, name_len));
+				StreamEvent e;
+				e.type = StreamEvent::Type::BEGIN;
+				e.connection = connection;
+				e.stream = (u32)id;
+				e.name = tmp;
+				e.offset = offset;
+				e.size = size;
+				if (m_stream_received_callback.isValid()) m_stream_received_callback.invoke(e);
+				break;
+			}
+			case StreamMessage::DATA: {
+				// canceled locally, chunks sent before the sender got REJECT are still coming
+				const i32 idx = findIncomingStream(connection, (u32)id);
+				if (idx < 0) return;
+
+				IncomingStream& s = m_incoming_streams[idx];
+				u64 offset;
+				if (!readVarint(blob, offset) || offset != s.received || blob.size() - blob.getPosition() > s.end - s.received) {
+					logError("Malformed stream message.");
+					rejectIncomingStream(*c, idx);
+					return;
+				}
+
+				StreamEvent e;
+				e.type = StreamEvent::Type::DATA;
+				e.connection = connection;
+				e.stream = s.id;
+				e.offset = offset;
+				e.size = s.end;
+				e.data = Span<const u8>(blob.getData() + blob.getPosition(), u32(blob.size() - blob.getPosition()));
+				s.received += e.data.length();
+				if (m_stream_received_callback.isValid()) m_stream_received_callback.invoke(e);
+
+				// the callback might have canceled the stream
+				const i32 after = findIncomingStream(connection, (u32)id);
+				if (after >= 0) {
+					IncomingStream& s2 = m_incoming_streams[after];
+					if (s2.received - s2.acked >= STREAM_ACK_INTERVAL) sendStreamAck(*c, s2);
+				}
+				break;
+			}
+			case StreamMessage::END: {
+				const i32 idx = findIncomingStream(connection, (u32)id);
+				if (idx < 0) return;
+
+				IncomingStream& s = m_incoming_streams[idx];
+				if (s.received != s.end) {
+					logError("Malformed stream message.");
+					rejectIncomingStream(*c, idx);
+					return;
+				}
+				sendStreamAck(*c, s);
+				finishIncomingStream(idx, StreamEvent::Type::END);
+				break;
+			}
+			case StreamMessage::CANCEL: {
+				const i32 idx = findIncomingStream(connection, (u32)id);
+				if (idx >= 0) finishIncomingStream(idx, StreamEvent::Type::CANCELED);
+				break;
+			}
+			case StreamMessage::ACK: {
+				const i32 idx = findOutgoingStream(connection, (u32)id);
+				if (idx < 0) return;
+
+				OutgoingStream& s = *m_outgoing_streams[idx];
+				u64 offset;
+				if (!readVarint(blob, offset) || offset < s.acked || offset > s.sent) {
+					logError("Malformed stream message.");
+					return;
+				}
+				c->stream_in_flight -= u32(offset - s.acked);
+				s.acked = offset;
+				if (s.acked == s.end) finishOutgoingStream(idx, true, true);
+				break;
+			}
+			case StreamMessage::REJECT: {
+				const i32 idx = findOutgoingStream(connection, (u32)id);
+				if (idx >= 0) finishOutgoingStream(idx, false, true);
+				break;
+			}
+			default:
+				logError("Malformed stream message.");
+				break;
+		}
 	}
 
 	const char* getName() const override { return "network"; }
 
 	Engine& m_engine;
 	IAllocator& m_allocator;
+	PacketPool m_packet_pool;
 	ENetHost* m_server_host = nullptr;
 	ENetHost* m_client_host = nullptr;
-
-	struct Connection {
-		ENetPeer* peer = nullptr;
-		bool is_server = false;
-	};
+	// hosts of a sharded server, each with its own thread, m_server_host is null if there are any
+	Array<NetThread*> m_shards;
+	HostConfig m_host_configs[2];
+	// copies of HostConfig::compression_dictionary
+	OutputMemoryStream m_compression_dictionaries[2];
 
 	Array<Connection> m_connections;
+	i32 m_first_free_connection = -1;
+	Array<RPCFunction> m_rpc_functions;
+	HashMap<RuntimeHash, u32> m_rpc_function_lookup;
+	OutputMemoryStream m_rpc_blob;
+	Replication m_replication;
+	OutputMemoryStream m_replication_blob;
+	Interest m_interest;
+	Array<EntityRef> m_relevant_entities;
+	OutputMemoryStream m_rpc_args_blob;
+	// connection indices of sendShared
+	Array<u32> m_recipients;
+	Array<OutgoingStream*> m_outgoing_streams;
+	Array<IncomingStream> m_incoming_streams;
+	OutputMemoryStream m_stream_blob;
+	StreamHandle m_next_stream = INVALID_STREAM;
+	u32 m_stream_bandwidth = 512 * 1024;
+	// bytes streams can send, negative after a chunk overdraws it
+	float m_stream_budget = 0;
+	struct {
+		u64 messages = 0;
+		u64 packets = 0;
+		i64 saved_bytes = 0;
+	} m_batch_stats;
+	u32 m_batch_messages_counter = 0;
+	u32 m_batch_saved_counter = 0;
+	// profiler counters of each HostType
+	HostCounters m_host_counters[2];
+	float m_host_counters_time = 0;
 	bool m_is_initialized = false;
+	NetThread* m_thread = nullptr;
 	int m_lua_callback_ref = -1;
+	int m_lua_interest_callback_ref = -1;
+	bool m_is_lua_batching = false;
+	Array<LuaEvent> m_lua_events;
+	Array<LuaRPC> m_lua_rpcs;
+	OutputMemoryStream m_lua_batch_data;
+	u32 m_lua_rpc_next = 0;
+	// reused table of the batch callback and the number of its entries
+	int m_lua_events_ref = -1;
+	u32 m_lua_events_size = 0;
 	lua_State* m_lua_callback_state = nullptr;
 	Delegate<void (ConnectionHandle, Span<const u8>)> m_receive_callback;
 	Delegate<void (ConnectionHandle)> m_connect_callback;
 	Delegate<void (ConnectionHandle)> m_disconnect_callback;
+	Delegate<void (const StreamEvent&)> m_stream_received_callback;
+	Delegate<void (StreamHandle, bool)> m_stream_sent_callback;
 };
 
 
@@ -4,20 +4,206 @@
 
 namespace Lumix {
 
+template <typename T> struct Array;
 template <typename T> struct Delegate;
+struct IInputStream;
+struct Interest;
+struct Replication;
 
 struct NetSystem : ISystem {
+	// generational handle, a handle of a closed connection never addresses a new one
 	using ConnectionHandle = i32;
 	static constexpr inline ConnectionHandle INVALID_CONNECTION = -1;
 
+	// Packet memory owned by the network system. Serialize directly into `data`, set `size`
+	// and pass it to `sendPacket`, which sends it without copying the payload.
+	struct Packet {
+		u8* data = nullptr;
+		u32 size = 0;
+		u32 capacity = 0;
+		void* handle = nullptr;
+	};
+
+	enum class HostType : u8 {
+		SERVER,
+		CLIENT
+	};
+
+	enum class Compression : u8 {
+		NONE,
+		// ENet's adaptive range coder, best ratio, slow
+		RANGE_CODER,
+		// LZCompressor, fast, optionally with a dictionary
+		LZ
+	};
+
+	enum class Checksum : u8 {
+		NONE,
+		// ENet's byte table CRC32
+		CRC32,
+		// CRC32C, with the crc32 instruction where the CPU has it
+		CRC32C
+	};
+
+	struct HostConfig {
+		// datagrams received / sent per system call (recvmmsg / sendmmsg on Linux), 0 or 1 for a call per datagram
+		u32 io_batch_size = 32;
+		// send consecutive datagrams to the same peer as one UDP GSO message, where the kernel supports it
+		bool udp_segmentation = false;
+		// new connections of the host batch messages, see `setBatching`
+		bool batch_messages = false;
+		// both sides of a connection must use the same compression and dictionary
+		Compression compression = Compression::NONE;
+		// primes LZ compression, see LZCompressor::trainDictionary, the data is copied
+		Span<const u8> compression_dictionary;
+		// adds 4 bytes to each datagram, corrupted datagrams are dropped, both sides of a connection must use the same checksum
+		Checksum checksum = Checksum::NONE;
+	};
+
+	// Transport statistics of a connection, read from ENet. Totals count whole datagrams since the connection
+	// was established and wrap around, diff two samples to get rates.
+	struct ConnectionStats {
+		// mean round trip time and its variance, in ms
+		u32 rtt = 0;
+		u32 rtt_variance = 0;
+		// mean loss of reliable packets, 0-1
+		float packet_loss = 0;
+		// share of unreliable packets ENet lets through, 0-1, it lowers it when the rtt grows
+		float throttle = 0;
+		u32 bytes_in = 0;
+		u32 bytes_out = 0;
+		u32 packets_in = 0;
+		u32 packets_out = 0;
+		// reliable commands queued or sent, not acknowledged yet
+		u32 reliable_pending = 0;
+		// bytes of reliable data sent, not acknowledged yet
+		u32 reliable_in_transit = 0;
+		// reliable commands sent again after their acknowledgement timed out
+		u32 resends = 0;
+	};
+
+	// id of an outgoing stream, see `sendStream`
+	using StreamHandle = u32;
+	static constexpr inline StreamHandle INVALID_STREAM = 0;
+
+	// Incoming stream notification. A stream is identified by its connection and the id the sender assigned.
+	struct StreamEvent {
+		enum class Type : u8 {
+			// `name`, `offset` the transfer starts at and the total `size` are set
+			BEGIN,
+			// `data` starting at `offset`, chunks arrive in order and without gaps
+			DATA,
+			// all data arrived
+			END,
+			// the sender canceled, the stream failed to read or the connection closed
+			CANCELED
+		};
+
+		Type type;
+		ConnectionHandle connection;
+		u32 stream;
+		const char* name = "";
+		u64 offset = 0;
+		u64 size = 0;
+		Span<const u8> data;
+	};
+
+	// State of the send scheduler of a connection, see `setSendBudget`
+	struct SchedulerStats {
+		// deferred, waiting in the scheduler after the last update
+		u32 pending_messages = 0;
+		u32 pending_bytes = 0;
+		// updates the oldest pending message has waited
+		u32 max_wait = 0;
+		// sent by the last update
+		u32 sent_messages = 0;
+		u32 sent_bytes = 0;
+		// unreliable messages replaced by newer ones with the same key, since the connection was established
+		u32 superseded = 0;
+	};
+
 	virtual bool createServer(u16 port, u32 max_clients) = 0;
+	// Server of `shard_count` hosts bound to the same port with SO_REUSEPORT, each serviced by its own thread at
+	// `tick_rate` Hz. The kernel assigns each client to one shard, so protocol work of different clients runs in
+	// parallel. Connections of all shards share one handle space, events are delivered in `update`, in order
+	// per connection. `max_clients` is per shard, fails where SO_REUSEPORT is not available, e.g. on Windows.
+	virtual bool createShardedServer(u16 port, u32 max_clients, u32 shard_count, u32 tick_rate) = 0;
 	virtual void destroyServer() = 0;
 	virtual ConnectionHandle connect(const char* host_name, u16 port) = 0;
 	virtual Delegate<void(ConnectionHandle, Span<const u8>)>& onDataReceived() = 0;
 	virtual Delegate<void(ConnectionHandle)>& onConnect() = 0;
 	virtual Delegate<void(ConnectionHandle)>& onDisconnect() = 0;
 	virtual bool send(ConnectionHandle connection, Span<const u8> data, bool reliable) = 0;
+	// Sends `data` on the same channel as `send` once the connection's send budget allows. Each update a pending
+	// message waits, its priority grows by `priority`, e.g. a weight of its category, and the scheduler sends messages
+	// with the highest priority first, so bulk data is delayed, not starved. A pending unreliable message with the
+	// same nonzero `key`, e.g. older state of the same entity, is dropped and the new one keeps its priority.
+	// Scheduled messages are not kept in order. Sent right away if the connection has no budget.
+	virtual bool sendScheduled(ConnectionHandle connection, Span<const u8> data, float priority, u32 key, bool reliable) = 0;
+	// bytes sent by the scheduler of the connection per `update`, 0 sends pending messages and disables it
+	virtual void setSendBudget(ConnectionHandle connection, u32 bytes_per_update) = 0;
+	// false if the connection is not valid
+	virtual bool getSchedulerStats(ConnectionHandle connection, SchedulerStats& stats) = 0;
+	// sends to all connections the entity is relevant to, see `getInterest`
+	virtual bool sendToRelevant(EntityRef entity, Span<const u8> data, bool reliable) = 0;
+	// Sends to all connections but `except`. All recipients share one packet, the payload is copied once
+	// (once per shard of a sharded server), not per recipient.
+	virtual bool broadcast(Span<const u8> data, bool reliable, ConnectionHandle except = INVALID_CONNECTION) = 0;
+	// same as `broadcast`, to connections of the group
+	virtual bool sendToGroup(const char* group, Span<const u8> data, bool reliable, ConnectionHandle except = INVALID_CONNECTION) = 0;
+	// named groups, e.g. teams or rooms, a connection can be in any number of groups and leaves them when it closes
+	virtual void addToGroup(const char* group, ConnectionHandle connection) = 0;
+	virtual void removeFromGroup(const char* group, ConnectionHandle connection) = 0;
+	virtual Packet reservePacket(u32 capacity) = 0;
+	// takes ownership of the packet, it's released even if sending fails
+	virtual bool sendPacket(ConnectionHandle connection, Packet& packet, bool reliable) = 0;
+	// releases a reserved packet which was not sent
+	virtual void releasePacket(Packet& packet) = 0;
 	virtual void disconnect(ConnectionHandle idx) = 0;
+	// Coalesces messages sent to the connection into one packet, each message prefixed with its channel and varint
+	// size. Batches are sent by `flush`, in `update`, when they reach MTU or when the reliability of messages changes,
+	// so messages keep their order, packets of `sendPacket` are copied to the batch. The receiver does not need batching enabled.
+	virtual void setBatching(ConnectionHandle connection, bool enabled) = 0;
+	virtual void flush() = 0;
+	// Threaded mode services hosts (acks, resends, pings) on a dedicated network thread, independent of the frame
+	// rate. The thread blocks until a datagram arrives, data is sent, ENet has to resend or ping, or at most
+	// 1 / `tick_rate` s. Events are still delivered on the game thread in `update`.
+	virtual void setThreaded(bool threaded, u32 tick_rate) = 0;
+	virtual bool isThreaded() const = 0;
+	// applied to the existing host of the type and to hosts created later
+	virtual void setHostConfig(HostType type, const HostConfig& config) = 0;
+	virtual const HostConfig& getHostConfig(HostType type) const = 0;
+	// false if the connection is not valid
+	virtual bool getConnectionStats(ConnectionHandle connection, ConnectionStats& stats) = 0;
+	// stats of all connections in one pass, `connections[i]` gets `stats[i]`, the arrays are cleared first
+	virtual void getConnectionStats(Array<ConnectionHandle>& connections, Array<ConnectionStats>& stats) = 0;
+	// Sends `size` bytes of `stream` on a dedicated reliable channel, in chunks read on demand in `update`, so neither
+	// side holds the whole payload. All streams share the budget of `setStreamBandwidth` and unacknowledged stream data
+	// of a connection is limited, so streams do not fill ENet's reliable window and delay other traffic.
+	// `stream` must stay valid until `onStreamSent`. `name` tells the receiver what is being sent, `offset` is the
+	// position of the stream's data in the whole payload. To resume, the receiver tells the sender (e.g. by RPC) how
+	// much it already has and the sender streams the rest.
+	virtual StreamHandle sendStream(ConnectionHandle connection, const char* name, IInputStream& stream, u64 offset, u64 size) = 0;
+	// streams the file from `offset` to its end, the file is open until the stream finishes
+	virtual StreamHandle sendFile(ConnectionHandle connection, const char* name, const char* path, u64 offset) = 0;
+	// callbacks are not called for streams canceled locally
+	virtual void cancelStream(StreamHandle stream) = 0;
+	// `stream` is StreamEvent::stream
+	virtual void cancelIncomingStream(ConnectionHandle connection, u32 stream) = 0;
+	// bytes per second shared by all outgoing streams, 0 for unlimited
+	virtual void setStreamBandwidth(u32 bytes_per_second) = 0;
+	virtual Delegate<void (const StreamEvent&)>& onStreamReceived() = 0;
+	// the receiver got all data (`completed`) or the stream failed, was rejected or the connection closed,
+	// the network system does not use the stream anymore
+	virtual Delegate<void (StreamHandle, bool completed)>& onStreamSent() = 0;
+	// register replicated fields and entities here, on clients bind the delegates applying received state
+	virtual Replication& getReplication() = 0;
+	// Server only, call once per network tick. Captures a snapshot of replicated entities and sends each client
+	// a delta against the last snapshot it acknowledged. Clients apply and acknowledge deltas in `update`.
+	virtual void replicate() = 0;
+	// Decides which entities are relevant to which connection. Replication sends clients with a viewer
+	// only relevant entities, `sendToRelevant` and Network.callRelevant only reach connections an entity is relevant to.
+	virtual Interest& getInterest() = 0;
 };
 
 } // namespace Lumix
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "core/allocator.h"
+#include "core/atomic.h"
+
+namespace Lumix {
+
+// position counters wrap around, compare them as signed distance
+inline i32 queueDistance(i32 a, i32 b) { return (i32)((u32)a - (u32)b); }
+
+// Bounded lock-free single producer / single consumer ring buffer. `T` must be trivially copyable.
+template <typename T>
+struct SPSCQueue {
+	SPSCQueue(IAllocator& allocator, u32 capacity)
+		: m_allocator(allocator)
+		, m_capacity(capacity)
+		, m_mask(capacity - 1)
+	{
+		ASSERT(capacity > 0 && (capacity & m_mask) == 0);
+		m_items = (T*)m_allocator.allocate(sizeof(T) * capacity, alignof(T));
+	}
+
+	~SPSCQueue() { m_allocator.deallocate(m_items); }
+
+	SPSCQueue(const SPSCQueue&) = delete;
+	void operator =(const SPSCQueue&) = delete;
+
+	// producer only
+	bool isFull() const { return queueDistance(m_write, m_read) >= (i32)m_capacity; }
+
+	// producer only
+	bool push(const T& value) {
+		const i32 write = m_write;
+		if (queueDistance(write, m_read) >= (i32)m_capacity) return false;
+		m_items[write & m_mask] = value;
+		memoryBarrier();
+		m_write = (i32)((u32)write + 1);
+		return true;
+	}
+
+	// consumer only
+	bool pop(T& value) {
+		const i32 read = m_read;
+		if (read == m_write) return false;
+		memoryBarrier();
+		value = m_items[read & m_mask];
+		memoryBarrier();
+		m_read = (i32)((u32)read + 1);
+		return true;
+	}
+
+private:
+	IAllocator& m_allocator;
+	T* m_items;
+	const u32 m_capacity;
+	const u32 m_mask;
+	alignas(64) AtomicI32 m_write = 0;
+	alignas(64) AtomicI32 m_read = 0;
+};
+
+// Bounded lock-free multiple producers / single consumer queue (Vyukov's bounded queue with a single consumer).
+// `T` must be trivially copyable.
+template <typename T>
+struct MPSCQueue {
+	MPSCQueue(IAllocator& allocator, u32 capacity)
+		: m_allocator(allocator)
+		, m_mask(capacity - 1)
+	{
+		ASSERT(capacity > 0 && (capacity & m_mask) == 0);
+		m_cells = (Cell*)m_allocator.allocate(sizeof(Cell) * capacity, alignof(Cell));
+		for (u32 i = 0; i < capacity; ++i) m_cells[i].sequence = (i32)i;
+	}
+
+	~MPSCQueue() { m_allocator.deallocate(m_cells); }
+
+	MPSCQueue(const MPSCQueue&) = delete;
+	void operator =(const MPSCQueue&) = delete;
+
+	bool push(const T& value) {
+		Cell* cell;
+		i32 pos = m_enqueue_pos;
+		for (;;) {
+			cell = &m_cells[pos & m_mask];
+			const i32 seq = cell->sequence;
+			const i32 diff = queueDistance(seq, pos);
+			if (diff == 0) {
+				if (m_enqueue_pos.compareExchange((i32)((u32)pos + 1), pos)) break;
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			pos = m_enqueue_pos;
+		}
+		cell->value = value;
+		memoryBarrier();
+		cell->sequence = (i32)((u32)pos + 1);
+		return true;
+	}
+
+	// consumer only
+	bool pop(T& value) {
+		const i32 pos = m_dequeue_pos;
+		Cell& cell = m_cells[pos & m_mask];
+		const i32 seq = cell.sequence;
+		if (queueDistance(seq, (i32)((u32)pos + 1)) < 0) return false;
+		memoryBarrier();
+		value = cell.value;
+		memoryBarrier();
+		cell.sequence = (i32)((u32)pos + m_mask + 1);
+		m_dequeue_pos = (i32)((u32)pos + 1);
+		return true;
+	}
+
+private:
+	struct Cell {
+		volatile i32 sequence;
+		T value;
+	};
+
+	IAllocator& m_allocator;
+	Cell* m_cells;
+	const u32 m_mask;
+	alignas(64) AtomicI32 m_enqueue_pos = 0;
+	alignas(64) i32 m_dequeue_pos = 0;
+};
+
+} // namespace Lumix
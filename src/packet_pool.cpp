@@ -0,0 +1,90 @@
+#include "packet_pool.h"
+
+namespace Lumix {
+
+// every block is prefixed with its size class so `deallocate` works with ENet's size-less free callback
+static constexpr u32 HEADER_SIZE = 16;
+static constexpr u32 LARGE_CLASS = 0xffFFffFF;
+static constexpr u32 PAGE_HEADER_SIZE = 16;
+
+PacketPool::PacketPool(IAllocator& allocator)
+	: m_allocator(allocator)
+{}
+
+PacketPool::~PacketPool() {
+	Page* page = m_pages;
+	while (page) {
+		Page* next = page->next;
+		m_allocator.deallocate(page);
+		page = next;
+	}
+}
+
+u32 PacketPool::getSizeClass(size_t size) {
+	u32 block_size = MIN_BLOCK_SIZE;
+	for (u32 i = 0; i < SIZE_CLASS_COUNT; ++i) {
+		if (size <= block_size) return i;
+		block_size <<= 1;
+	}
+	return LARGE_CLASS;
+}
+
+void* PacketPool::allocateFromClass(u32 size_class) {
+	SizeClass& c = m_classes[size_class];
+	if (c.free_list) {
+		FreeBlock* block = c.free_list;
+		c.free_list = block->next;
+		return block;
+	}
+
+	const u32 block_size = (MIN_BLOCK_SIZE << size_class) + HEADER_SIZE;
+	if (c.page_cursor + block_size > c.page_end) {
+		u8* mem = (u8*)m_allocator.allocate(PAGE_SIZE, 16);
+		if (!mem) return nullptr;
+		Page* page = (Page*)mem;
+		page->next = m_pages;
+		m_pages = page;
+		c.page_cursor = mem + PAGE_HEADER_SIZE;
+		c.page_end = mem + PAGE_SIZE;
+	}
+
+	void* block = c.page_cursor;
+	c.page_cursor += block_size;
+	return block;
+}
+
+void* PacketPool::allocate(size_t size) {
+	const u32 size_class = getSizeClass(size);
+	u8* block;
+	if (size_class == LARGE_CLASS) {
+		block = (u8*)m_allocator.allocate(size + HEADER_SIZE, 16);
+	}
+	else {
+		MutexGuard guard(m_mutex);
+		block = (u8*)allocateFromClass(size_class);
+	}
+	if (!block) return nullptr;
+
+	*(u32*)block = size_class;
+	return block + HEADER_SIZE;
+}
+
+void PacketPool::deallocate(void* ptr) {
+	if (!ptr) return;
+
+	u8* block = (u8*)ptr - HEADER_SIZE;
+	const u32 size_class = *(u32*)block;
+	if (size_class == LARGE_CLASS) {
+		m_allocator.deallocate(block);
+		return;
+	}
+
+	ASSERT(size_class < SIZE_CLASS_COUNT);
+	FreeBlock* free_block = (FreeBlock*)block;
+	MutexGuard guard(m_mutex);
+	SizeClass& c = m_classes[size_class];
+	free_block->next = c.free_list;
+	c.free_list = free_block;
+}
+
+} // namespace Lumix
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "core/allocator.h"
+#include "core/sync.h"
+
+namespace Lumix {
+
+// Size-class pools for ENet's allocations (packet headers, payloads, protocol commands).
+// Blocks are carved from pages allocated from the engine allocator and never returned to it
+// until the pool is destroyed, so steady-state traffic does not hit the general allocator.
+// Thread safe, packets are allocated on the network thread and freed on the game thread.
+struct PacketPool {
+	static constexpr u32 MIN_BLOCK_SIZE = 32;
+	static constexpr u32 SIZE_CLASS_COUNT = 8; // 32B .. 4KB, bigger allocations go to the parent allocator
+	static constexpr u32 PAGE_SIZE = 64 * 1024;
+
+	explicit PacketPool(IAllocator& allocator);
+	~PacketPool();
+
+	void* allocate(size_t size);
+	void deallocate(void* ptr);
+
+	IAllocator& getAllocator() { return m_allocator; }
+
+private:
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	struct Page {
+		Page* next;
+	};
+
+	struct SizeClass {
+		FreeBlock* free_list = nullptr;
+		u8* page_cursor = nullptr;
+		u8* page_end = nullptr;
+	};
+
+	static u32 getSizeClass(size_t size);
+	void* allocateFromClass(u32 size_class);
+
+	IAllocator& m_allocator;
+	Mutex m_mutex;
+	SizeClass m_classes[SIZE_CLASS_COUNT];
+	Page* m_pages = nullptr;
+};
+
+} // namespace Lumix
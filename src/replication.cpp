@@ -0,0 +1,512 @@
+#include "core/allocator.h"
+#include "core/math.h"
+#include "core/stream.h"
+#include "replication.h"
+#include "varint.h"
+#include <string.h>
+
+namespace Lumix {
+
+// Delta format:
+//	varint tick, varint baseline tick (0 = full state)
+//	varint removed count, entity index gaps
+//	varint added count, (entity index gap, varint field mask, values) for each
+//	varint changed count; if not 0, a bit per entity present in both snapshots, then for every
+//	changed entity a bit per its field and the values of the changed fields
+// Entities whose set of fields changed are sent as removed and added.
+
+static const u8* readBytes(InputMemoryStream& blob, u64 len) {
+	if (len > blob.size() - blob.getPosition()) return nullptr;
+	return (const u8*)blob.skip(len);
+}
+
+static bool isBitSet(const u8* bits, u32 idx) { return bits[idx >> 3] & (1 << (idx & 7)); }
+
+Replication::Snapshot::Snapshot(IAllocator& allocator)
+	: entities(allocator)
+	, data(allocator)
+{}
+
+void Replication::Snapshot::clear() {
+	tick = 0;
+	entities.clear();
+	data.clear();
+}
+
+void Replication::Snapshot::copyTo(Snapshot& dst) const {
+	dst.tick = tick;
+	dst.entities.clear();
+	dst.entities.reserve(entities.size());
+	for (const SnapshotEntity& e : entities) dst.entities.push(e);
+	dst.data.resize(data.size());
+	if (data.size() > 0) memcpy(dst.data.begin(), data.begin(), data.size());
+}
+
+Replication::Client::Client(IAllocator& allocator)
+	: m_history(allocator)
+{
+	m_history.reserve(HISTORY_SIZE);
+	for (u32 i = 0; i < HISTORY_SIZE; ++i) m_history.emplace(allocator);
+}
+
+void Replication::Client::reset() {
+	for (Sent& sent : m_history) {
+		sent.tick = 0;
+		sent.entities.clear();
+	}
+}
+
+Replication::Replication(IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_fields(allocator)
+	, m_entities(allocator)
+	, m_history(allocator)
+	, m_applied(allocator)
+	, m_tmp_removed(allocator)
+	, m_tmp_added(allocator)
+	, m_tmp_common(allocator)
+	, m_tmp_changed(allocator)
+	, m_tmp_entities(allocator)
+	, m_tmp_data(allocator)
+{
+	m_history.reserve(HISTORY_SIZE);
+	for (u32 i = 0; i < HISTORY_SIZE; ++i) m_history.emplace(allocator);
+}
+
+u32 Replication::registerField(const char* name, u32 size, const ReadFn& read, const WriteFn& write) {
+	ASSERT(m_fields.size() < MAX_FIELDS);
+	ASSERT(size > 0);
+	Field& field = m_fields.emplace(m_allocator);
+	field.name = name;
+	field.size = size;
+	field.read = read;
+	field.write = write;
+	return m_fields.size() - 1;
+}
+
+template <typename T>
+static u32 lowerBound(const Array<T>& entities, EntityRef entity) {
+	u32 lo = 0;
+	u32 hi = entities.size();
+	while (lo < hi) {
+		const u32 mid = (lo + hi) >> 1;
+		if (entities[mid].entity.index < entity.index) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+void Replication::addEntity(EntityRef entity, FieldMask fields) {
+	ASSERT((fields & ~getValidFieldMask()) == 0);
+	const u32 idx = lowerBound(m_entities, entity);
+	if (idx < (u32)m_entities.size() && m_entities[idx].entity == entity) {
+		m_entities[idx].fields = fields;
+		return;
+	}
+	m_entities.insert(idx, {entity, fields});
+}
+
+void Replication::removeEntity(EntityRef entity) {
+	const u32 idx = lowerBound(m_entities, entity);
+	if (idx < (u32)m_entities.size() && m_entities[idx].entity == entity) m_entities.erase(idx);
+}
+
+u32 Replication::getDataSize(FieldMask fields) const {
+	u32 size = 0;
+	for (u32 i = 0, c = m_fields.size(); i < c; ++i) {
+		if (fields & (FieldMask(1) << i)) size += m_fields[i].size;
+	}
+	return size;
+}
+
+Replication::FieldMask Replication::getValidFieldMask() const {
+	return m_fields.size() == MAX_FIELDS ? ~FieldMask(0) : (FieldMask(1) << m_fields.size()) - 1;
+}
+
+Replication::View Replication::getView(const Snapshot& snapshot) {
+	View view;
+	view.tick = snapshot.tick;
+	view.entities = snapshot.entities.begin();
+	view.count = snapshot.entities.size();
+	view.data = snapshot.data.begin();
+	return view;
+}
+
+Replication::View Replication::getView(const Snapshot& snapshot, const Client::Sent& sent) {
+	View view = getView(snapshot);
+	if (!sent.all) {
+		view.entities = sent.entities.begin();
+		view.count = sent.entities.size();
+	}
+	return view;
+}
+
+const Replication::Snapshot* Replication::getSnapshot(u32 tick) const {
+	if (tick == 0) return nullptr;
+	const Snapshot& snapshot = m_history[tick % HISTORY_SIZE];
+	return snapshot.tick == tick ? &snapshot : nullptr;
+}
+
+u32 Replication::captureSnapshot() {
+	++m_tick;
+	Snapshot& snapshot = m_history[m_tick % HISTORY_SIZE];
+	snapshot.clear();
+	snapshot.tick = m_tick;
+	snapshot.entities.reserve(m_entities.size());
+
+	u32 data_size = 0;
+	for (const ReplicatedEntity& e : m_entities) {
+		snapshot.entities.push({e.entity, e.fields, data_size});
+		data_size += getDataSize(e.fields);
+	}
+	snapshot.data.resize(data_size);
+
+	u8* ptr = snapshot.data.begin();
+	for (const ReplicatedEntity& e : m_entities) {
+		for (u32 i = 0, c = m_fields.size(); i < c; ++i) {
+			if (!(e.fields & (FieldMask(1) << i))) continue;
+			const Field& field = m_fields[i];
+			field.read.invoke(e.entity, Span<u8>(ptr, field.size));
+			ptr += field.size;
+		}
+	}
+	return m_tick;
+}
+
+void Replication::writeDelta(u32 baseline_tick, OutputMemoryStream& blob) {
+	ASSERT(m_tick > 0);
+	const Snapshot* baseline = m_tick - baseline_tick < HISTORY_SIZE ? getSnapshot(baseline_tick) : nullptr;
+	writeDelta(baseline ? getView(*baseline) : View(), getView(m_history[m_tick % HISTORY_SIZE]), blob);
+}
+
+void Replication::writeDelta(Client& client, u32 baseline_tick, const Array<EntityRef>* relevant, OutputMemoryStream& blob) {
+	ASSERT(m_tick > 0);
+	const Snapshot& snapshot = m_history[m_tick % HISTORY_SIZE];
+	Client::Sent& sent = client.m_history[m_tick % HISTORY_SIZE];
+	sent.tick = m_tick;
+	sent.all = !relevant;
+	sent.entities.clear();
+	if (relevant) {
+		for (EntityRef e : *relevant) {
+			const u32 idx = lowerBound(snapshot.entities, e);
+			if (idx == (u32)snapshot.entities.size() || snapshot.entities[idx].entity != e) continue;
+			if (!sent.entities.empty() && sent.entities.last().entity == e) continue;
+			sent.entities.push(snapshot.entities[idx]);
+		}
+	}
+
+	View baseline;
+	if (m_tick - baseline_tick < HISTORY_SIZE) {
+		const Snapshot* baseline_snapshot = getSnapshot(baseline_tick);
+		const Client::Sent& baseline_sent = client.m_history[baseline_tick % HISTORY_SIZE];
+		if (baseline_snapshot && baseline_sent.tick == baseline_tick) baseline = getView(*baseline_snapshot, baseline_sent);
+	}
+	writeDelta(baseline, getView(snapshot, sent), blob);
+}
+
+void Replication::writeDelta(const View& baseline, const View& current, OutputMemoryStream& blob) {
+	writeVarint(blob, current.tick);
+	writeVarint(blob, baseline.tick);
+
+	m_tmp_removed.clear();
+	m_tmp_added.clear();
+	m_tmp_common.clear(); // pairs of baseline and current index
+	u32 b = 0, c = 0;
+	while (b < baseline.count || c < current.count) {
+		if (c == current.count || (b < baseline.count && baseline.entities[b].entity.index < current.entities[c].entity.index)) {
+			m_tmp_removed.push(b++);
+		}
+		else if (b == baseline.count || current.entities[c].entity.index < baseline.entities[b].entity.index) {
+			m_tmp_added.push(c++);
+		}
+		else {
+			if (baseline.entities[b].fields == current.entities[c].fields) {
+				m_tmp_common.push(b);
+				m_tmp_common.push(c);
+			}
+			else {
+				m_tmp_removed.push(b);
+				m_tmp_added.push(c);
+			}
+			++b;
+			++c;
+		}
+	}
+
+	i32 prev = -1;
+	writeVarint(blob, m_tmp_removed.size());
+	for (u32 idx : m_tmp_removed) {
+		const i32 entity = baseline.entities[idx].entity.index;
+		writeVarint(blob, u32(entity - prev - 1));
+		prev = entity;
+	}
+
+	prev = -1;
+	writeVarint(blob, m_tmp_added.size());
+	for (u32 idx : m_tmp_added) {
+		const SnapshotEntity& e = current.entities[idx];
+		writeVarint(blob, u32(e.entity.index - prev - 1));
+		writeVarint(blob, e.fields);
+		blob.write(current.data + e.offset, getDataSize(e.fields));
+		prev = e.entity.index;
+	}
+
+	const u32 common_count = m_tmp_common.size() / 2;
+	m_tmp_changed.clear();
+	m_tmp_changed.reserve(common_count);
+	u32 changed_count = 0;
+	for (u32 i = 0; i < common_count; ++i) {
+		const SnapshotEntity& be = baseline.entities[m_tmp_common[i * 2]];
+		const SnapshotEntity& ce = current.entities[m_tmp_common[i * 2 + 1]];
+		const u8* bv = baseline.data + be.offset;
+		const u8* cv = current.data + ce.offset;
+		FieldMask changed = 0;
+		if (memcmp(bv, cv, getDataSize(ce.fields)) != 0) {
+			// bit per field the entity has, not per registered field
+			u32 local_idx = 0;
+			for (u32 f = 0, fc = m_fields.size(); f < fc; ++f) {
+				if (!(ce.fields & (FieldMask(1) << f))) continue;
+				const u32 size = m_fields[f].size;
+				if (memcmp(bv, cv, size) != 0) changed |= FieldMask(1) << local_idx;
+				bv += size;
+				cv += size;
+				++local_idx;
+			}
+			++changed_count;
+		}
+		m_tmp_changed.push(changed);
+	}
+
+	writeVarint(blob, changed_count);
+	if (changed_count == 0) return;
+
+	for (u32 i = 0; i < common_count; i += 8) {
+		u8 byte = 0;
+		for (u32 j = i, end = minimum(i + 8, common_count); j < end; ++j) {
+			if (m_tmp_changed[j]) byte |= 1 << (j - i);
+		}
+		blob.write(byte);
+	}
+
+	for (u32 i = 0; i < common_count; ++i) {
+		const FieldMask changed = m_tmp_changed[i];
+		if (!changed) continue;
+
+		const SnapshotEntity& ce = current.entities[m_tmp_common[i * 2 + 1]];
+		u32 local_count = 0;
+		for (u32 f = 0, fc = m_fields.size(); f < fc; ++f) {
+			if (ce.fields & (FieldMask(1) << f)) ++local_count;
+		}
+		for (u32 j = 0; j < local_count; j += 8) blob.write(u8(changed >> j));
+
+		const u8* cv = current.data + ce.offset;
+		u32 local_idx = 0;
+		for (u32 f = 0, fc = m_fields.size(); f < fc; ++f) {
+			if (!(ce.fields & (FieldMask(1) << f))) continue;
+			const u32 size = m_fields[f].size;
+			if (changed & (FieldMask(1) << local_idx)) blob.write(cv, size);
+			cv += size;
+			++local_idx;
+		}
+	}
+}
+
+bool Replication::readDelta(InputMemoryStream& blob, u32& tick) {
+	u64 current_tick, baseline_tick;
+	if (!readVarint(blob, current_tick) || !readVarint(blob, baseline_tick)) return false;
+	if (current_tick == 0 || current_tick > 0xffFFffFF || baseline_tick >= current_tick) return false;
+
+	View baseline;
+	if (baseline_tick != 0) {
+		// the baseline and the result can not share a history slot
+		if (current_tick - baseline_tick >= HISTORY_SIZE) return false;
+		const Snapshot* snapshot = getSnapshot((u32)baseline_tick);
+		if (!snapshot) return false;
+		baseline = getView(*snapshot);
+	}
+
+	tick = (u32)current_tick;
+	Snapshot& result = m_history[tick % HISTORY_SIZE];
+	if (result.tick == tick) return true;
+
+	if (!readDelta(blob, baseline, result)) {
+		result.clear();
+		return false;
+	}
+	result.tick = tick;
+	if (tick > m_applied.tick) apply(result);
+	return true;
+}
+
+bool Replication::readDelta(InputMemoryStream& blob, const View& baseline, Snapshot& result) {
+	result.clear();
+	const FieldMask valid_fields = getValidFieldMask();
+
+	u64 count;
+	if (!readVarint(blob, count) || count > baseline.count) return false;
+	m_tmp_removed.clear();
+	i64 entity = -1;
+	u32 b = 0;
+	for (u64 i = 0; i < count; ++i) {
+		u64 gap;
+		if (!readVarint(blob, gap) || gap > 0x7fffFFFF) return false;
+		entity += gap + 1;
+		while (b < baseline.count && baseline.entities[b].entity.index < entity) ++b;
+		if (b == baseline.count || baseline.entities[b].entity.index != entity) return false;
+		m_tmp_removed.push(b++);
+	}
+
+	// every added entity takes at least two bytes
+	if (!readVarint(blob, count) || count > blob.size() - blob.getPosition()) return false;
+	m_tmp_entities.clear();
+	m_tmp_data.clear();
+	// values of added entities can't take more than what's left
+	m_tmp_data.reserve(u32(blob.size() - blob.getPosition()));
+	entity = -1;
+	for (u64 i = 0; i < count; ++i) {
+		u64 gap, fields;
+		if (!readVarint(blob, gap) || !readVarint(blob, fields)) return false;
+		if (gap > 0x7fffFFFF || (fields & ~valid_fields)) return false;
+		entity += gap + 1;
+		if (entity > 0x7fffFFFF) return false;
+
+		const u32 size = getDataSize(fields);
+		const u8* values = readBytes(blob, size);
+		if (!values) return false;
+		const u32 offset = m_tmp_data.size();
+		m_tmp_data.resize(offset + size);
+		if (size > 0) memcpy(m_tmp_data.begin() + offset, values, size);
+		m_tmp_entities.push({EntityRef{(i32)entity}, fields, offset});
+	}
+
+	const u32 common_count = baseline.count - m_tmp_removed.size();
+	const u8* changed_bits = nullptr;
+	if (!readVarint(blob, count) || count > common_count) return false;
+	if (count > 0) {
+		changed_bits = readBytes(blob, (common_count + 7) / 8);
+		if (!changed_bits) return false;
+	}
+
+	u32 data_size = m_tmp_data.size();
+	u32 r = 0;
+	for (u32 i = 0; i < baseline.count; ++i) {
+		if (r < (u32)m_tmp_removed.size() && m_tmp_removed[r] == i) ++r;
+		else data_size += getDataSize(baseline.entities[i].fields);
+	}
+	result.entities.reserve(common_count + m_tmp_entities.size());
+	result.data.resize(data_size);
+
+	u8* out = result.data.begin();
+	u32 added_idx = 0;
+	auto emitAdded = [&](){
+		const SnapshotEntity& e = m_tmp_entities[added_idx++];
+		const u32 size = getDataSize(e.fields);
+		result.entities.push({e.entity, e.fields, u32(out - result.data.begin())});
+		if (size > 0) memcpy(out, m_tmp_data.begin() + e.offset, size);
+		out += size;
+	};
+
+	r = 0;
+	u32 common_idx = 0;
+	for (u32 i = 0; i < baseline.count; ++i) {
+		if (r < (u32)m_tmp_removed.size() && m_tmp_removed[r] == i) {
+			++r;
+			continue;
+		}
+
+		const SnapshotEntity& be = baseline.entities[i];
+		while (added_idx < (u32)m_tmp_entities.size() && m_tmp_entities[added_idx].entity.index < be.entity.index) emitAdded();
+		if (added_idx < (u32)m_tmp_entities.size() && m_tmp_entities[added_idx].entity == be.entity) return false;
+
+		const u32 size = getDataSize(be.fields);
+		result.entities.push({be.entity, be.fields, u32(out - result.data.begin())});
+		if (size > 0) memcpy(out, baseline.data + be.offset, size);
+
+		if (changed_bits && isBitSet(changed_bits, common_idx)) {
+			u32 local_count = 0;
+			for (u32 f = 0, fc = m_fields.size(); f < fc; ++f) {
+				if (be.fields & (FieldMask(1) << f)) ++local_count;
+			}
+			const u8* changed_fields = readBytes(blob, (local_count + 7) / 8);
+			if (!changed_fields) return false;
+
+			u8* value = out;
+			u32 local_idx = 0;
+			for (u32 f = 0, fc = m_fields.size(); f < fc; ++f) {
+				if (!(be.fields & (FieldMask(1) << f))) continue;
+				const u32 field_size = m_fields[f].size;
+				if (isBitSet(changed_fields, local_idx)) {
+					const u8* src = readBytes(blob, field_size);
+					if (!src) return false;
+					memcpy(value, src, field_size);
+				}
+				value += field_size;
+				++local_idx;
+			}
+		}
+		out += size;
+		++common_idx;
+	}
+	while (added_idx < (u32)m_tmp_entities.size()) emitAdded();
+	return true;
+}
+
+void Replication::resetClient() {
+	for (Snapshot& snapshot : m_history) snapshot.clear();
+	if (m_entity_removed.isValid()) {
+		for (const SnapshotEntity& e : m_applied.entities) m_entity_removed.invoke(e.entity);
+	}
+	m_applied.clear();
+}
+
+void Replication::apply(const Snapshot& snapshot) {
+	auto writeFields = [&](const SnapshotEntity& e, const SnapshotEntity* prev) {
+		const u8* value = snapshot.data.begin() + e.offset;
+		const u8* prev_value = prev ? m_applied.data.begin() + prev->offset : nullptr;
+		for (u32 f = 0, fc = m_fields.size(); f < fc; ++f) {
+			if (!(e.fields & (FieldMask(1) << f))) continue;
+			const Field& field = m_fields[f];
+			if (!prev_value || memcmp(prev_value, value, field.size) != 0) {
+				if (field.write.isValid()) field.write.invoke(e.entity, Span<const u8>(value, field.size));
+			}
+			value += field.size;
+			if (prev_value) prev_value += field.size;
+		}
+	};
+
+	auto remove = [&](const SnapshotEntity& e) {
+		if (m_entity_removed.isValid()) m_entity_removed.invoke(e.entity);
+	};
+
+	auto add = [&](const SnapshotEntity& e) {
+		if (m_entity_added.isValid()) m_entity_added.invoke(e.entity);
+		writeFields(e, nullptr);
+	};
+
+	const Array<SnapshotEntity>& prev = m_applied.entities;
+	const Array<SnapshotEntity>& next = snapshot.entities;
+	u32 p = 0, n = 0;
+	while (p < (u32)prev.size() || n < (u32)next.size()) {
+		if (n == (u32)next.size() || (p < (u32)prev.size() && prev[p].entity.index < next[n].entity.index)) {
+			remove(prev[p++]);
+		}
+		else if (p == (u32)prev.size() || next[n].entity.index < prev[p].entity.index) {
+			add(next[n++]);
+		}
+		else {
+			if (prev[p].fields == next[n].fields) {
+				writeFields(next[n], &prev[p]);
+			}
+			else {
+				remove(prev[p]);
+				add(next[n]);
+			}
+			++p;
+			++n;
+		}
+	}
+
+	snapshot.copyTo(m_applied);
+}
+
+} // namespace Lumix
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "core/array.h"
+#include "core/core.h"
+#include "core/delegate.h"
+#include "core/string.h"
+
+namespace Lumix {
+
+struct InputMemoryStream;
+struct OutputMemoryStream;
+
+// Snapshot based entity state replication. The server samples registered fields of replicated entities
+// into a snapshot every tick, each client receives a delta against the last snapshot it acknowledged.
+// Fields must be registered in the same order on the server and on clients. Clients identify entities
+// by the server's EntityRef, it's up to the game to map them to local entities.
+struct Replication {
+	static constexpr u32 MAX_FIELDS = 64;
+	// clients whose last acknowledged snapshot is older than this (in ticks) get full state
+	static constexpr u32 HISTORY_SIZE = 32;
+
+	using FieldMask = u64;
+	// server, copies the entity's value of the field to the buffer
+	using ReadFn = Delegate<void (EntityRef, Span<u8>)>;
+	// client, applies a received value
+	using WriteFn = Delegate<void (EntityRef, Span<const u8>)>;
+
+	struct SnapshotEntity {
+		EntityRef entity;
+		FieldMask fields;
+		// offset of the entity's values in snapshot's data, values are in the order of fields
+		u32 offset;
+	};
+
+	// entities sent to a client in recent ticks, needed when clients get only some entities
+	struct Client {
+		explicit Client(IAllocator& allocator);
+		void reset();
+
+	private:
+		friend struct Replication;
+
+		struct Sent {
+			Sent(IAllocator& allocator) : entities(allocator) {}
+
+			u32 tick = 0;
+			bool all = false;
+			Array<SnapshotEntity> entities;
+		};
+
+		Array<Sent> m_history; // indexed by tick % HISTORY_SIZE
+	};
+
+	explicit Replication(IAllocator& allocator);
+
+	// `size` is the size of the field's serialized value in bytes, returns the field's index
+	u32 registerField(const char* name, u32 size, const ReadFn& read, const WriteFn& write);
+	u32 getFieldsCount() const { return m_fields.size(); }
+
+	// server
+	// sets which fields are replicated for the entity, adds the entity if it's not replicated yet
+	void addEntity(EntityRef entity, FieldMask fields);
+	void removeEntity(EntityRef entity);
+	// samples all replicated entities into a new snapshot, returns its tick
+	u32 captureSnapshot();
+	u32 getTick() const { return m_tick; }
+	// writes the latest snapshot as a delta against `baseline_tick`, or as full state if that snapshot
+	// is not in history anymore (or `baseline_tick` is 0)
+	void writeDelta(u32 baseline_tick, OutputMemoryStream& blob);
+	// same as above with only `relevant` entities (sorted), or all entities if it's nullptr, the set can change
+	// every tick, entities which are no longer relevant are sent as removed
+	void writeDelta(Client& client, u32 baseline_tick, const Array<EntityRef>* relevant, OutputMemoryStream& blob);
+
+	// client
+	// decodes a delta and applies it if it's newer than the current state, `tick` is set to the tick the client
+	// should acknowledge; returns false if the delta is malformed or its baseline is unknown
+	bool readDelta(InputMemoryStream& blob, u32& tick);
+	// forgets received snapshots, so the next delta must be full state, entities of the applied state
+	// are reported as removed; call when the connection to the server is lost
+	void resetClient();
+	Delegate<void (EntityRef)>& onEntityAdded() { return m_entity_added; }
+	Delegate<void (EntityRef)>& onEntityRemoved() { return m_entity_removed; }
+
+private:
+	struct Field {
+		Field(IAllocator& allocator) : name(allocator) {}
+
+		String name;
+		u32 size = 0;
+		ReadFn read;
+		WriteFn write;
+	};
+
+	struct ReplicatedEntity {
+		EntityRef entity;
+		FieldMask fields;
+	};
+
+	struct Snapshot {
+		Snapshot(IAllocator& allocator);
+		void clear();
+		void copyTo(Snapshot& dst) const;
+
+		u32 tick = 0; // 0 is an empty snapshot
+		Array<SnapshotEntity> entities; // sorted by entity
+		Array<u8> data;
+	};
+
+	struct View {
+		u32 tick = 0;
+		const SnapshotEntity* entities = nullptr;
+		u32 count = 0;
+		const u8* data = nullptr;
+	};
+
+	static View getView(const Snapshot& snapshot);
+	static View getView(const Snapshot& snapshot, const Client::Sent& sent);
+	u32 getDataSize(FieldMask fields) const;
+	FieldMask getValidFieldMask() const;
+	const Snapshot* getSnapshot(u32 tick) const;
+	void writeDelta(const View& baseline, const View& current, OutputMemoryStream& blob);
+	bool readDelta(InputMemoryStream& blob, const View& baseline, Snapshot& result);
+	void apply(const Snapshot& snapshot);
+
+	IAllocator& m_allocator;
+	Array<Field> m_fields;
+	Array<ReplicatedEntity> m_entities; // sorted by entity
+	Array<Snapshot> m_history; // indexed by tick % HISTORY_SIZE
+	Snapshot m_applied;
+	u32 m_tick = 0;
+	Delegate<void (EntityRef)> m_entity_added;
+	Delegate<void (EntityRef)> m_entity_removed;
+
+	// scratch buffers used while encoding / decoding deltas
+	Array<u32> m_tmp_removed;
+	Array<u32> m_tmp_added;
+	Array<u32> m_tmp_common;
+	Array<FieldMask> m_tmp_changed;
+	Array<SnapshotEntity> m_tmp_entities;
+	Array<u8> m_tmp_data;
+};
+
+} // namespace Lumix
@@ -0,0 +1,243 @@
+#include "core/log.h"
+#include "core/stream.h"
+#include "lua/lua_wrapper.h"
+#include "rpc.h"
+#include "varint.h"
+
+namespace Lumix::rpc {
+
+// Values are prefixed with a tag byte, the low nibble is the type, the high nibble holds
+// small payloads (integers 0-15, lengths of short strings) so they don't need more bytes.
+enum class Tag : u8 {
+	NIL,
+	FALSE,
+	TRUE,
+	SMALL_INT,	// value in the high nibble
+	INT,		// zigzag varint
+	FLOAT,		// numbers exactly representable as f32
+	DOUBLE,
+	STRING,		// high nibble is length + 1 for strings shorter than 15 bytes, otherwise 0 and varint length follows
+	VECTOR,		// 3 x f32
+	TABLE		// varint array size, array values, (key, value) pairs terminated by a nil key
+};
+
+static constexpr u32 MAX_TABLE_DEPTH = 16;
+static constexpr double MAX_SAFE_INTEGER = 9007199254740991.0; // 2^53 - 1
+
+static void writeTag(OutputMemoryStream& blob, Tag tag, u8 payload = 0) {
+	blob.write(u8((u8)tag | (payload << 4)));
+}
+
+void writeString(OutputMemoryStream& blob, const char* str, u32 len) {
+	writeVarint(blob, len);
+	blob.write(str, len);
+}
+
+static const char* readBytes(InputMemoryStream& blob, u64 len) {
+	if (len > blob.size() - blob.getPosition()) return nullptr;
+	return (const char*)blob.skip(len);
+}
+
+const char* readString(InputMemoryStream& blob, u32& len) {
+	u64 tmp;
+	if (!readVarint(blob, tmp)) return nullptr;
+	len = (u32)tmp;
+	return readBytes(blob, tmp);
+}
+
+static void writeNumber(OutputMemoryStream& blob, double value) {
+	// range check first, it also filters out NaN
+	if (value >= -MAX_SAFE_INTEGER && value <= MAX_SAFE_INTEGER && value == (double)(i64)value) {
+		const i64 i = (i64)value;
+		if (i >= 0 && i < 16) {
+			writeTag(blob, Tag::SMALL_INT, (u8)i);
+			return;
+		}
+		writeTag(blob, Tag::INT);
+		writeVarint(blob, zigzagEncode(i));
+		return;
+	}
+
+	const float f = (float)value;
+	if ((double)f == value) {
+		writeTag(blob, Tag::FLOAT);
+		blob.write(f);
+		return;
+	}
+
+	writeTag(blob, Tag::DOUBLE);
+	blob.write(value);
+}
+
+static bool writeValue(OutputMemoryStream& blob, lua_State* L, int idx, u32 depth);
+
+static bool isArrayKey(lua_State* L, int idx, int array_size) {
+	if (lua_type(L, idx) != LUA_TNUMBER) return false;
+	const double key = lua_tonumber(L, idx);
+	return key >= 1 && key <= array_size && key == (double)(int)key;
+}
+
+static bool writeTable(OutputMemoryStream& blob, lua_State* L, int idx, u32 depth) {
+	if (depth > MAX_TABLE_DEPTH) {
+		logError("RPC argument tables are nested too deep (or recursive)");
+		return false;
+	}
+	if (!lua_checkstack(L, 3)) return false;
+
+	const int array_size = lua_objlen(L, idx);
+	writeTag(blob, Tag::TABLE);
+	writeVarint(blob, array_size);
+	for (int i = 1; i <= array_size; ++i) {
+		lua_rawgeti(L, idx, i);
+		const bool res = writeValue(blob, L, -1, depth);
+		lua_pop(L, 1);
+		if (!res) return false;
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, idx)) {
+		if (isArrayKey(L, -2, array_size)) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if (!writeValue(blob, L, -2, depth) || !writeValue(blob, L, -1, depth)) {
+			lua_pop(L, 2);
+			return false;
+		}
+		lua_pop(L, 1);
+	}
+	writeTag(blob, Tag::NIL);
+	return true;
+}
+
+static bool writeValue(OutputMemoryStream& blob, lua_State* L, int idx, u32 depth) {
+	idx = lua_absindex(L, idx);
+	switch (lua_type(L, idx)) {
+		case LUA_TNIL: writeTag(blob, Tag::NIL); return true;
+		case LUA_TBOOLEAN: writeTag(blob, lua_toboolean(L, idx) ? Tag::TRUE : Tag::FALSE); return true;
+		case LUA_TNUMBER: writeNumber(blob, lua_tonumber(L, idx)); return true;
+		case LUA_TSTRING: {
+			size_t len;
+			const char* str = lua_tolstring(L, idx, &len);
+			if (len < 15) {
+				writeTag(blob, Tag::STRING, u8(len + 1));
+				blob.write(str, len);
+			}
+			else {
+				writeTag(blob, Tag::STRING);
+				writeString(blob, str, (u32)len);
+			}
+			return true;
+		}
+		case LUA_TVECTOR: {
+			const float* v = lua_tovector(L, idx);
+			writeTag(blob, Tag::VECTOR);
+			blob.write(v, sizeof(float) * 3);
+			return true;
+		}
+		case LUA_TTABLE: return writeTable(blob, L, idx, depth + 1);
+		default: return false;
+	}
+}
+
+bool writeArgs(OutputMemoryStream& blob, lua_State* L, int first, int count) {
+	writeVarint(blob, count);
+	for (int i = 0; i < count; ++i) {
+		if (!writeValue(blob, L, first + i, 0)) {
+			logError("RPC argument #", i + 1, " has unsupported type ", lua_typename(L, lua_type(L, first + i)));
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readValue(InputMemoryStream& blob, lua_State* L, u32 depth);
+
+static bool readTable(InputMemoryStream& blob, lua_State* L, u32 depth) {
+	if (depth > MAX_TABLE_DEPTH) return false;
+	u64 array_size;
+	if (!readVarint(blob, array_size)) return false;
+	// every value takes at least one byte
+	if (array_size > blob.size() - blob.getPosition()) return false;
+	if (!lua_checkstack(L, 3)) return false;
+
+	lua_createtable(L, (int)array_size, 0);
+	for (u64 i = 1; i <= array_size; ++i) {
+		if (!readValue(blob, L, depth)) return false;
+		lua_rawseti(L, -2, (int)i);
+	}
+
+	for (;;) {
+		if (!readValue(blob, L, depth)) return false;
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			return true;
+		}
+		// lua_rawset raises an error on NaN keys, nil keys are not possible since nil ends the table
+		if (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1)) return false;
+		if (!readValue(blob, L, depth)) return false;
+		lua_rawset(L, -3);
+	}
+}
+
+static bool readValue(InputMemoryStream& blob, lua_State* L, u32 depth) {
+	u8 tag;
+	if (!blob.read(&tag, 1)) return false;
+	const u8 payload = tag >> 4;
+	switch ((Tag)(tag & 0xf)) {
+		case Tag::NIL: lua_pushnil(L); return true;
+		case Tag::FALSE: lua_pushboolean(L, 0); return true;
+		case Tag::TRUE: lua_pushboolean(L, 1); return true;
+		case Tag::SMALL_INT: lua_pushnumber(L, payload); return true;
+		case Tag::INT: {
+			u64 value;
+			if (!readVarint(blob, value)) return false;
+			lua_pushnumber(L, (double)zigzagDecode(value));
+			return true;
+		}
+		case Tag::FLOAT: {
+			float value;
+			if (!blob.read(&value, sizeof(value))) return false;
+			lua_pushnumber(L, value);
+			return true;
+		}
+		case Tag::DOUBLE: {
+			double value;
+			if (!blob.read(&value, sizeof(value))) return false;
+			lua_pushnumber(L, value);
+			return true;
+		}
+		case Tag::STRING: {
+			u32 len = payload - 1;
+			const char* str = payload ? readBytes(blob, len) : readString(blob, len);
+			if (!str) return false;
+			lua_pushlstring(L, str, len);
+			return true;
+		}
+		case Tag::VECTOR: {
+			float v[3];
+			if (!blob.read(v, sizeof(v))) return false;
+			lua_pushvector(L, v[0], v[1], v[2]);
+			return true;
+		}
+		case Tag::TABLE: return readTable(blob, L, depth + 1);
+	}
+	return false;
+}
+
+int readArgs(InputMemoryStream& blob, lua_State* L) {
+	const int top = lua_gettop(L);
+	u64 count;
+	if (!readVarint(blob, count)) return -1;
+	if (count > blob.size() - blob.getPosition() || !lua_checkstack(L, (int)count + 1)) return -1;
+
+	for (u64 i = 0; i < count; ++i) {
+		if (!readValue(blob, L, 0)) {
+			lua_settop(L, top);
+			return -1;
+		}
+	}
+	return (int)count;
+}
+
+} // namespace Lumix::rpc
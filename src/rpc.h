@@ -0,0 +1,35 @@
+#pragma once
+
+#include "core/core.h"
+
+struct lua_State;
+
+namespace Lumix {
+
+struct InputMemoryStream;
+struct OutputMemoryStream;
+
+namespace rpc {
+
+// first byte of every message on the RPC channel
+enum class MessageType : u8 {
+	// varint count, then (varint id, string name) pairs the sender accepts in CALL_BY_ID
+	FUNCTION_TABLE,
+	// varint id, varint arg count, args
+	CALL_BY_ID,
+	// string name, varint arg count, args; used until the receiver's function table arrives
+	CALL_BY_NAME
+};
+
+void writeString(OutputMemoryStream& blob, const char* str, u32 len);
+// returns nullptr on malformed input, the string is not null terminated
+const char* readString(InputMemoryStream& blob, u32& len);
+
+// encodes Lua values at stack indices [first, first + count), logs an error for unsupported types
+bool writeArgs(OutputMemoryStream& blob, lua_State* L, int first, int count);
+// pushes decoded values, returns their count or -1 on malformed input (nothing is left on the stack)
+int readArgs(InputMemoryStream& blob, lua_State* L);
+
+} // namespace rpc
+
+} // namespace Lumix
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "core/stream.h"
+
+namespace Lumix {
+
+// LEB128, 7 bits per byte, small values take a single byte
+inline void writeVarint(OutputMemoryStream& stream, u64 value) {
+	u8 tmp[10];
+	u32 size = 0;
+	while (value >= 0x80) {
+		tmp[size++] = u8(value) | 0x80;
+		value >>= 7;
+	}
+	tmp[size++] = u8(value);
+	stream.write(tmp, size);
+}
+
+inline bool readVarint(InputMemoryStream& stream, u64& value) {
+	value = 0;
+	for (u32 shift = 0; shift < 64; shift += 7) {
+		u8 byte;
+		if (!stream.read(&byte, 1)) return false;
+		value |= u64(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+inline u64 zigzagEncode(i64 value) { return (u64(value) << 1) ^ u64(value >> 63); }
+inline i64 zigzagDecode(u64 value) { return i64(value >> 1) ^ -i64(value & 1); }
+
+} // namespace Lumix
@@ -0,0 +1,150 @@
+// Round trips of quantized values at the limits of their ranges, decoding of malformed values.
+// A value quantized one step above the range would spill a bit into the next field, so cases are followed by a marker.
+
+#include "core/allocator.h"
+#include "core/math.h"
+#include "core/stream.h"
+#include "bit_stream.h"
+#include <math.h>
+#include <stdio.h>
+
+using namespace Lumix;
+
+namespace {
+
+u32 g_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++g_failures; \
+		} \
+	} while (false)
+
+constexpr u32 MARKER = 0x5;
+constexpr u32 MARKER_BITS = 3;
+
+void testFloatLimits(IAllocator& allocator) {
+	struct Range {
+		float min;
+		float max;
+		float precision;
+	};
+	const Range ranges[] = {
+		{-1000, 1000, 1e-4f},
+		{0, 1, 1e-3f},
+		{-1, 1, 1e-6f},
+		{-100000, 100000, 1e-3f},
+	};
+	for (const Range& r : ranges) {
+		const float values[] = {r.min, r.max, nextafterf(r.max, r.min), nextafterf(r.min, r.max), r.max + 1, r.min - 1};
+		OutputMemoryStream blob(allocator);
+		{
+			BitWriter writer(blob);
+			for (float v : values) {
+				writer.writeFloat(v, r.min, r.max, r.precision);
+				writer.write(MARKER, MARKER_BITS);
+			}
+			writer.writeFloats(Span<const float>(values, lengthOf(values)), r.min, r.max, r.precision);
+			writer.write(MARKER, MARKER_BITS);
+		}
+
+		BitReader reader(blob.data(), (u32)blob.size());
+		for (float v : values) {
+			const float expected = minimum(maximum(v, r.min), r.max);
+			const float res = reader.readFloat(r.min, r.max, r.precision);
+			CHECK(res >= r.min && res <= r.max);
+			CHECK(fabsf(res - expected) <= r.precision);
+			CHECK(reader.read(MARKER_BITS) == MARKER);
+		}
+		float res[lengthOf(values)];
+		reader.readFloats(Span<float>(res, lengthOf(res)), r.min, r.max, r.precision);
+		for (u32 i = 0; i < lengthOf(values); ++i) {
+			const float expected = minimum(maximum(values[i], r.min), r.max);
+			CHECK(fabsf(res[i] - expected) <= r.precision);
+		}
+		CHECK(reader.read(MARKER_BITS) == MARKER);
+		CHECK(reader.isValid());
+	}
+}
+
+void testQuatLimits(IAllocator& allocator) {
+	const float h = 0.70710678f; // 1 / sqrt(2), the biggest value of a component which is not the largest
+	const Quat quats[] = {
+		{h, h, 0, 0},
+		{h, -h, 0, 0},
+		{0, 0, -h, h},
+		{0.5f, 0.5f, 0.5f, 0.5f},
+		{-0.5f, 0.5f, -0.5f, 0.5f},
+		{0, 0, 0, 1},
+	};
+	for (u32 bits = 8; bits <= 31; ++bits) {
+		OutputMemoryStream blob(allocator);
+		{
+			BitWriter writer(blob);
+			for (const Quat& q : quats) {
+				writer.writeQuat(q, bits);
+				writer.write(MARKER, MARKER_BITS);
+			}
+		}
+
+		BitReader reader(blob.data(), (u32)blob.size());
+		for (const Quat& q : quats) {
+			const Quat res = reader.readQuat(bits);
+			// q and -q are the same rotation
+			const float dot = q.x * res.x + q.y * res.y + q.z * res.z + q.w * res.w;
+			CHECK(fabsf(dot) > 0.999f);
+			CHECK(reader.read(MARKER_BITS) == MARKER);
+		}
+		CHECK(reader.isValid());
+	}
+}
+
+// a value above the range is not produced by the writer, only by malformed input
+void testOutOfRange(IAllocator& allocator) {
+	OutputMemoryStream blob(allocator);
+	{
+		BitWriter writer(blob);
+		// 0..1000 steps, 10 bits
+		writer.write(1023, 10);
+	}
+	BitReader reader(blob.data(), (u32)blob.size());
+	CHECK(reader.readFloat(0, 1, 1e-3f) == 0);
+	CHECK(!reader.isValid());
+}
+
+void testAlign(IAllocator& allocator) {
+	OutputMemoryStream blob(allocator);
+	{
+		BitWriter writer(blob);
+		writer.writeInt(5, 0, 7);
+		writer.flush();
+		writer.writeInt(-3, -4, 3);
+		writer.writeBool(true);
+	}
+	CHECK(blob.size() == 2);
+	BitReader reader(blob.data(), (u32)blob.size());
+	CHECK(reader.readInt(0, 7) == 5);
+	reader.align();
+	CHECK(reader.readInt(-4, 3) == -3);
+	CHECK(reader.readBool());
+	CHECK(reader.isValid());
+}
+
+} // anonymous namespace
+
+int main() {
+	DefaultAllocator allocator;
+	testFloatLimits(allocator);
+	testQuatLimits(allocator);
+	testOutOfRange(allocator);
+	testAlign(allocator);
+
+	if (g_failures > 0) {
+		printf("%u checks failed\n", g_failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
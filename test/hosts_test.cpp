@@ -0,0 +1,111 @@
+// Lifetime of hosts in threaded mode. The network thread queues events of all hosts into one queue,
+// destroying the server must not leave events pointing to its peers there, nor drop events of the client.
+// net.cpp is included, so the test can construct NetSystemImpl without loading the plugin.
+
+#include "core/allocator.h"
+#include "core/os.h"
+#include "engine/engine.h"
+#include "net.cpp"
+#include <stdio.h>
+
+using namespace Lumix;
+
+namespace {
+
+u32 g_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++g_failures; \
+		} \
+	} while (false)
+
+constexpr u16 PORT = 34580;
+constexpr u32 MESSAGES_COUNT = 16;
+
+struct Listener {
+	void onConnect(NetSystem::ConnectionHandle connection) {
+		if (net->getConnection(connection)->is_server) server_connection = connection;
+		else client_connection = connection;
+	}
+
+	void onDataReceived(NetSystem::ConnectionHandle connection, Span<const u8> data) {
+		if (connection == client_connection) ++client_received;
+		else ++server_received;
+	}
+
+	NetSystemImpl* net;
+	NetSystem::ConnectionHandle server_connection = NetSystem::INVALID_CONNECTION;
+	NetSystem::ConnectionHandle client_connection = NetSystem::INVALID_CONNECTION;
+	u32 client_received = 0;
+	u32 server_received = 0;
+};
+
+// updates until both sides of the connection are connected, or 5 seconds pass
+bool waitForConnection(NetSystemImpl& net, Listener& listener) {
+	for (u32 i = 0; i < 500; ++i) {
+		net.update(0.01f);
+		if (listener.server_connection != NetSystem::INVALID_CONNECTION && listener.client_connection != NetSystem::INVALID_CONNECTION) return true;
+		os::sleep(10);
+	}
+	return false;
+}
+
+void testDestroyServer(NetSystemImpl& net, Listener& listener) {
+	net.setThreaded(true, 60);
+	CHECK(net.createServer(PORT, 8));
+	CHECK(net.connect("127.0.0.1", PORT) != NetSystem::INVALID_CONNECTION);
+	CHECK(waitForConnection(net, listener));
+
+	// both hosts queue RECEIVE events, the game thread does not take them before the server is destroyed
+	const u8 data[64] = {};
+	for (u32 i = 0; i < MESSAGES_COUNT; ++i) {
+		CHECK(net.send(listener.server_connection, Span<const u8>(data, sizeof(data)), true));
+		CHECK(net.send(listener.client_connection, Span<const u8>(data, sizeof(data)), true));
+	}
+	net.flush();
+	os::sleep(500);
+
+	net.destroyServer();
+	CHECK(!net.getConnection(listener.server_connection));
+	for (u32 i = 0; i < 10; ++i) {
+		net.update(0.01f);
+		os::sleep(10);
+	}
+	CHECK(listener.server_received == 0);
+	CHECK(listener.client_received == MESSAGES_COUNT);
+	CHECK(net.getConnection(listener.client_connection));
+
+	// the client's peer still points to the destroyed server, a new server gets a new connection
+	listener.server_connection = listener.client_connection = NetSystem::INVALID_CONNECTION;
+	CHECK(net.createServer(PORT + 1, 8));
+	CHECK(net.connect("127.0.0.1", PORT + 1) != NetSystem::INVALID_CONNECTION);
+	CHECK(waitForConnection(net, listener));
+	net.destroyServer();
+	net.setThreaded(false, 60);
+}
+
+} // anonymous namespace
+
+int main() {
+	DefaultAllocator allocator;
+	auto engine = Engine::create({}, allocator);
+	Listener listener;
+	{
+		NetSystemImpl net(*engine);
+		CHECK(net.m_is_initialized);
+		listener.net = &net;
+		net.onConnect().bind<&Listener::onConnect>(&listener);
+		net.onDataReceived().bind<&Listener::onDataReceived>(&listener);
+		if (net.m_is_initialized) testDestroyServer(net, listener);
+	}
+
+	if (g_failures > 0) {
+		printf("%u checks failed\n", g_failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,98 @@
+// Decoding of RPC arguments from malformed input. Every case must fail cleanly, without raising
+// a Lua error, since RPCs are decoded outside of pcall, and leave nothing on the stack.
+
+#include "core/allocator.h"
+#include "core/stream.h"
+#include "lua/lua_wrapper.h"
+#include "rpc.h"
+#include <math.h>
+#include <stdio.h>
+
+using namespace Lumix;
+
+namespace {
+
+// same as rpc::Tag
+enum Tag : u8 {
+	NIL = 0,
+	SMALL_INT = 3,
+	FLOAT = 5,
+	DOUBLE = 6,
+	TABLE = 9
+};
+
+u32 g_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++g_failures; \
+		} \
+	} while (false)
+
+// one table argument {[key] = 1}
+void writeTable(OutputMemoryStream& blob, Tag key_tag, const void* key, u32 key_size) {
+	blob.write(u8(1)); // argument count
+	blob.write(u8(TABLE));
+	blob.write(u8(0)); // array size
+	blob.write(u8(key_tag));
+	blob.write(key, key_size);
+	blob.write(u8(SMALL_INT | (1 << 4)));
+	blob.write(u8(NIL));
+}
+
+void testValidKey(IAllocator& allocator, lua_State* L) {
+	OutputMemoryStream blob(allocator);
+	const double key = 1.5;
+	writeTable(blob, DOUBLE, &key, sizeof(key));
+
+	InputMemoryStream input(blob.data(), blob.size());
+	const int top = lua_gettop(L);
+	CHECK(rpc::readArgs(input, L) == 1);
+	CHECK(lua_istable(L, -1));
+	lua_pushnumber(L, key);
+	lua_rawget(L, -2);
+	CHECK(lua_tonumber(L, -1) == 1);
+	lua_settop(L, top);
+}
+
+void testNaNKey(IAllocator& allocator, lua_State* L) {
+	{
+		OutputMemoryStream blob(allocator);
+		const double key = nan("");
+		writeTable(blob, DOUBLE, &key, sizeof(key));
+
+		InputMemoryStream input(blob.data(), blob.size());
+		const int top = lua_gettop(L);
+		CHECK(rpc::readArgs(input, L) == -1);
+		CHECK(lua_gettop(L) == top);
+	}
+	{
+		OutputMemoryStream blob(allocator);
+		const float key = nanf("");
+		writeTable(blob, FLOAT, &key, sizeof(key));
+
+		InputMemoryStream input(blob.data(), blob.size());
+		const int top = lua_gettop(L);
+		CHECK(rpc::readArgs(input, L) == -1);
+		CHECK(lua_gettop(L) == top);
+	}
+}
+
+} // anonymous namespace
+
+int main() {
+	DefaultAllocator allocator;
+	lua_State* L = luaL_newstate();
+	testValidKey(allocator, L);
+	testNaNKey(allocator, L);
+	lua_close(L);
+
+	if (g_failures > 0) {
+		printf("%u checks failed\n", g_failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}